@@ -0,0 +1,1783 @@
+// SPDX-License-Identifier: (GPL-2.0-or-later OR BSD-2-Clause)
+/*
+ * libfdt - Flat Device Tree manipulation
+ *
+ * Lookup indexes: side tables kept beside a blob in caller supplied
+ * memory, consulted by the read-only functions and updated by the
+ * read-write functions.
+ */
+#include "libfdt_env.h"
+
+#include <fdt.h>
+#include <libfdt.h>
+
+#include "libfdt_internal.h"
+
+static struct fdt_index *fdt_indexes_[FDT_INDEX_MAX_ATTACHED];
+static int fdt_nindexes_;
+
+struct fdt_index *fdt_index_get_(const void *fdt)
+{
+	int i;
+
+	if (!fdt_nindexes_)
+		return NULL;
+
+	for (i = 0; i < FDT_INDEX_MAX_ATTACHED; i++)
+		if (fdt_indexes_[i] && (fdt_indexes_[i]->fdt == fdt))
+			return fdt_indexes_[i];
+
+	return NULL;
+}
+
+int fdt_index_init(struct fdt_index *idx, const void *fdt)
+{
+	/* A blob still being written sequentially may only have strings */
+	if (fdt_magic(fdt) != FDT_SW_MAGIC)
+		FDT_RO_PROBE(fdt);
+
+	memset(idx, 0, sizeof(*idx));
+	idx->fdt = fdt;
+	return 0;
+}
+
+int fdt_index_attach(struct fdt_index *idx)
+{
+	int i, slot = -1;
+
+	for (i = 0; i < FDT_INDEX_MAX_ATTACHED; i++) {
+		if (fdt_indexes_[i] && (fdt_indexes_[i]->fdt == idx->fdt)) {
+			fdt_indexes_[i] = idx;
+			return 0;
+		}
+		if (!fdt_indexes_[i] && (slot < 0))
+			slot = i;
+	}
+
+	if (slot < 0)
+		return -FDT_ERR_NOSPACE;
+
+	fdt_indexes_[slot] = idx;
+	fdt_nindexes_++;
+	return 0;
+}
+
+void fdt_index_detach(struct fdt_index *idx)
+{
+	int i;
+
+	for (i = 0; i < FDT_INDEX_MAX_ATTACHED; i++)
+		if (fdt_indexes_[i] == idx) {
+			fdt_indexes_[i] = NULL;
+			fdt_nindexes_--;
+		}
+}
+
+/*
+ * Keep a node offset in step with a splice of the structure block
+ * replacing @oldlen bytes at @offset by @newlen bytes. Returns 1 if the
+ * node was inside the removed region, 0 otherwise.
+ */
+static int fdt_index_shift_(int *nodeoffset, int offset, int oldlen,
+			    int newlen)
+{
+	if (*nodeoffset < offset)
+		return 0;
+
+	if (*nodeoffset < (offset + oldlen))
+		return 1;
+
+	*nodeoffset += newlen - oldlen;
+	return 0;
+}
+
+/**********************************************************************/
+/* phandle table                                                      */
+/**********************************************************************/
+
+static inline int fdt_index_phandle_hash_(uint32_t phandle, int mask)
+{
+	return (phandle * 2654435761U) & mask;
+}
+
+static int fdt_index_phandle_slot_(struct fdt_index *idx, uint32_t phandle)
+{
+	int h = fdt_index_phandle_hash_(phandle, idx->ph_mask);
+
+	while ((idx->ph_slots[h] >= 0)
+	       && (idx->ph_ents[idx->ph_slots[h]].phandle != phandle))
+		h = (h + 1) & idx->ph_mask;
+
+	return h;
+}
+
+/* Record a phandle, unless it is already known. Returns 0 or -NOSPACE */
+static int fdt_index_phandle_insert_(struct fdt_index *idx, uint32_t phandle,
+				     int offset)
+{
+	int h = fdt_index_phandle_slot_(idx, phandle);
+
+	if (idx->ph_slots[h] >= 0)
+		return 0;
+
+	if (idx->ph_count >= idx->ph_max)
+		return -FDT_ERR_NOSPACE;
+
+	idx->ph_ents[idx->ph_count].phandle = phandle;
+	idx->ph_ents[idx->ph_count].offset = offset;
+	idx->ph_slots[h] = idx->ph_count++;
+	return 0;
+}
+
+int fdt_index_is_phandle_name_(const char *name, int namelen)
+{
+	return ((namelen == (sizeof("phandle") - 1))
+		&& (memcmp(name, "phandle", namelen) == 0))
+		|| ((namelen == (sizeof("linux,phandle") - 1))
+		    && (memcmp(name, "linux,phandle", namelen) == 0));
+}
+
+int fdt_index_phandles(struct fdt_index *idx, void *buf, int bufsize)
+{
+	const void *fdt = idx->fdt;
+	int offset = 0, nextoffset, nodeoffset = -1;
+	unsigned int slotsize;
+	int nslots, i, err;
+	uint32_t tag;
+
+	FDT_RO_PROBE(fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	idx->ph_slots = NULL;
+
+	/* Half of the hash slots stay free, to keep probe chains short */
+	slotsize = sizeof(int) + sizeof(struct fdt_index_phandle) / 2;
+	if ((bufsize < 0) || ((unsigned)bufsize < (2 * slotsize)))
+		return -FDT_ERR_NOSPACE;
+	for (nslots = 2; (nslots * 2 * slotsize) <= (unsigned)bufsize;
+	     nslots *= 2)
+		;
+
+	idx->ph_mask = nslots - 1;
+	idx->ph_max = nslots / 2;
+	idx->ph_count = 0;
+	idx->ph_highest_known = 0;
+	idx->ph_ents = (struct fdt_index_phandle *)
+		((char *)buf + nslots * sizeof(int));
+	idx->ph_slots = buf;
+	for (i = 0; i < nslots; i++)
+		idx->ph_slots[i] = -1;
+
+	do {
+		tag = fdt_next_tag(fdt, offset, &nextoffset);
+
+		if (tag == FDT_BEGIN_NODE) {
+			nodeoffset = offset;
+		} else if (tag == FDT_PROP) {
+			const struct fdt_property *prop;
+			const char *name;
+			int namelen;
+
+			prop = fdt_offset_ptr_(fdt, offset);
+			if (fdt32_ld_(&prop->len) != sizeof(fdt32_t))
+				goto next;
+
+			name = fdt_get_string(fdt, fdt32_ld_(&prop->nameoff),
+					      &namelen);
+			if (!name || !fdt_index_is_phandle_name_(name, namelen))
+				goto next;
+
+			err = fdt_index_phandle_insert_(idx,
+				fdt32_ld_((const fdt32_t *)prop->data),
+				nodeoffset);
+			if (err) {
+				idx->ph_slots = NULL;
+				return err;
+			}
+		}
+	next:
+		offset = nextoffset;
+	} while (tag != FDT_END);
+
+	if (nextoffset < 0) {
+		idx->ph_slots = NULL;
+		return nextoffset;
+	}
+
+	idx->ph_complete = 1;
+	return 0;
+}
+
+int fdt_index_phandle_offset_(struct fdt_index *idx, uint32_t phandle)
+{
+	int h, offset;
+
+	if (!idx->ph_slots)
+		return -FDT_ERR_BADSTATE;
+
+	h = fdt_index_phandle_slot_(idx, phandle);
+	if (idx->ph_slots[h] < 0)
+		return idx->ph_complete ? -FDT_ERR_NOTFOUND : -FDT_ERR_BADSTATE;
+
+	/* The entry is only a hint, check it against the tree itself */
+	offset = idx->ph_ents[idx->ph_slots[h]].offset;
+	if ((offset < 0) || (fdt_get_phandle(idx->fdt, offset) != phandle))
+		return -FDT_ERR_BADSTATE;
+
+	return offset;
+}
+
+void fdt_index_phandle_add_(struct fdt_index *idx, uint32_t phandle,
+			    int offset)
+{
+	int h;
+
+	if (!idx->ph_slots)
+		return;
+
+	h = fdt_index_phandle_slot_(idx, phandle);
+	if (idx->ph_slots[h] >= 0)
+		idx->ph_ents[idx->ph_slots[h]].offset = offset;
+	else if (fdt_index_phandle_insert_(idx, phandle, offset))
+		idx->ph_complete = 0;
+}
+
+/*
+ * The highest phandle in the tree, as last found by a full walk and
+ * raised as phandles were set since. Nodes losing their phandle or
+ * going away can only lower the maximum, so it is trusted for as long
+ * as a node found through the table still holds it.
+ */
+int fdt_index_max_phandle_(struct fdt_index *idx, uint32_t *phandle)
+{
+	if (!idx->ph_slots || !idx->ph_highest_known)
+		return -FDT_ERR_BADSTATE;
+
+	if (idx->ph_highest
+	    && (fdt_index_phandle_offset_(idx, idx->ph_highest) < 0)) {
+		idx->ph_highest_known = 0;
+		return -FDT_ERR_BADSTATE;
+	}
+
+	*phandle = idx->ph_highest;
+	return 0;
+}
+
+void fdt_index_max_phandle_set_(struct fdt_index *idx, uint32_t phandle)
+{
+	if (!idx->ph_slots)
+		return;
+
+	idx->ph_highest = phandle;
+	idx->ph_highest_known = 1;
+}
+
+/*
+ * @nodeoffset gained @phandle. Lookups return the first such node in
+ * tree order: a live entry is only replaced by an earlier node, and a
+ * stale one is left for the next lookup to resolve, as other nodes
+ * before @nodeoffset may hold the phandle too.
+ */
+static void fdt_index_phandle_note_(struct fdt_index *idx, uint32_t phandle,
+				    int nodeoffset)
+{
+	struct fdt_index_phandle *e;
+	int h;
+
+	h = fdt_index_phandle_slot_(idx, phandle);
+	if (idx->ph_slots[h] < 0) {
+		if (fdt_index_phandle_insert_(idx, phandle, nodeoffset))
+			idx->ph_complete = 0;
+		return;
+	}
+
+	e = &idx->ph_ents[idx->ph_slots[h]];
+	if ((e->offset < 0)
+	    || (fdt_get_phandle(idx->fdt, e->offset) != phandle))
+		e->offset = -1;
+	else if (nodeoffset < e->offset)
+		e->offset = nodeoffset;
+}
+
+/**********************************************************************/
+/* Node table                                                         */
+/**********************************************************************/
+
+int fdt_index_nodes(struct fdt_index *idx, void *buf, int bufsize)
+{
+	const void *fdt = idx->fdt;
+	struct fdt_index_node *nodes = buf;
+	int offset = 0, nextoffset, cur = -1, count = 0, max;
+	uint32_t tag;
+
+	FDT_RO_PROBE(fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	idx->nodes = NULL;
+	max = (bufsize < 0) ? 0 : (bufsize / sizeof(*nodes));
+
+	/* The parent links double as the stack of open nodes */
+	do {
+		tag = fdt_next_tag(fdt, offset, &nextoffset);
+
+		if (tag == FDT_BEGIN_NODE) {
+			if (count >= max)
+				return -FDT_ERR_NOSPACE;
+
+			nodes[count].offset = offset;
+			nodes[count].parent = cur;
+			nodes[count].depth = (cur < 0) ? 0
+				: (nodes[cur].depth + 1);
+			nodes[count].end = -1;
+			nodes[count].props = -1;
+			nodes[count].nprops = 0;
+			nodes[count].path = -1;
+			cur = count++;
+		} else if (tag == FDT_END_NODE) {
+			if (cur < 0)
+				return -FDT_ERR_BADSTRUCTURE;
+
+			nodes[cur].end = nextoffset;
+			cur = nodes[cur].parent;
+		}
+
+		offset = nextoffset;
+	} while (tag != FDT_END);
+
+	if (nextoffset < 0)
+		return nextoffset;
+	if (cur >= 0)
+		return -FDT_ERR_BADSTRUCTURE;
+
+	idx->nodes = nodes;
+	idx->node_count = count;
+	idx->node_max = max;
+	return 0;
+}
+
+/* Index of the first entry at or after @offset */
+static int fdt_index_node_bound_(const struct fdt_index *idx, int offset)
+{
+	int lo = 0, hi = idx->node_count;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (idx->nodes[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int fdt_index_node_find_(const struct fdt_index *idx, int nodeoffset)
+{
+	int i;
+
+	if (!idx->nodes)
+		return -1;
+
+	i = fdt_index_node_bound_(idx, nodeoffset);
+	if ((i >= idx->node_count) || (idx->nodes[i].offset != nodeoffset))
+		return -1;
+
+	return i;
+}
+
+/* Index of the entry just past the subtree of entry @i */
+int fdt_index_node_next_(const struct fdt_index *idx, int i)
+{
+	return fdt_index_node_bound_(idx, idx->nodes[i].end);
+}
+
+static void fdt_index_nodes_splice_(struct fdt_index *idx, int offset,
+				    int oldlen, int newlen)
+{
+	struct fdt_index_node *nodes = idx->nodes;
+	int delta = newlen - oldlen;
+	int first, last, removed, i;
+
+	/* Entries [first, last) describe nodes in the removed region */
+	first = fdt_index_node_bound_(idx, offset);
+	last = oldlen ? fdt_index_node_bound_(idx, offset + oldlen) : first;
+	removed = last - first;
+
+	/* The properties of the node before may have moved within it */
+	if (first > 0)
+		nodes[first - 1].props = -1;
+
+	for (i = 0; i < idx->node_count; i++) {
+		if (i >= last)
+			nodes[i].offset += delta;
+		if (nodes[i].end > offset)
+			nodes[i].end += delta;
+	}
+
+	if (!removed)
+		return;
+
+	memmove(&nodes[first], &nodes[last],
+		(idx->node_count - last) * sizeof(*nodes));
+	idx->node_count -= removed;
+
+	for (i = first; i < idx->node_count; i++) {
+		if (nodes[i].parent >= last) {
+			nodes[i].parent -= removed;
+		} else if (nodes[i].parent >= first) {
+			/* Only part of a subtree went away, give up */
+			idx->nodes = NULL;
+			return;
+		}
+	}
+}
+
+/*
+ * Paths of nodes, as returned by fdt_get_path(). The parent links give
+ * the names from the node up to the root; the paths built from them are
+ * kept in the string area until it fills up, when it is emptied again.
+ * Renaming a node changes the paths below it, so it empties the area.
+ */
+static void fdt_index_node_paths_clear_(struct fdt_index *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->node_count; i++)
+		idx->nodes[i].path = -1;
+	idx->npath_strused = 0;
+}
+
+int fdt_index_node_paths(struct fdt_index *idx, void *buf, int bufsize)
+{
+	FDT_RO_PROBE(idx->fdt);
+
+	if (bufsize < 0)
+		return -FDT_ERR_NOSPACE;
+
+	idx->npath_strs = NULL;
+	if (!idx->nodes)
+		return -FDT_ERR_BADSTATE;
+
+	idx->npath_strs = buf;
+	idx->npath_strsize = bufsize;
+	fdt_index_node_paths_clear_(idx);
+	return 0;
+}
+
+/*
+ * The path of entry @i does not fit in @buf. Like the scan of the tree,
+ * fill in the names from the root as far as they fit.
+ */
+static int fdt_index_get_path_nospace_(struct fdt_index *idx, int i,
+				       char *buf, int buflen)
+{
+	const struct fdt_index_node *nodes = idx->nodes;
+	const char *name;
+	int j, p, len;
+
+	for (j = i, p = 0; j >= 0; j = nodes[j].parent) {
+		if (!fdt_get_name(idx->fdt, nodes[j].offset, &len))
+			return -FDT_ERR_BADSTATE;
+		p += len + 1;
+	}
+
+	for (j = i; j >= 0; j = nodes[j].parent) {
+		name = fdt_get_name(idx->fdt, nodes[j].offset, &len);
+		p -= len + 1;
+		if ((p + len + 1) <= buflen) {
+			memcpy(buf + p, name, len);
+			buf[p + len] = '/';
+		}
+	}
+
+	return -FDT_ERR_NOSPACE;
+}
+
+int fdt_index_get_path_(struct fdt_index *idx, int nodeoffset, char *buf,
+			int buflen)
+{
+	const void *fdt = idx->fdt;
+	struct fdt_index_node *nodes = idx->nodes;
+	const char *name;
+	int i, j, p, size, len;
+
+	if (!nodes)
+		return -FDT_ERR_BADSTATE;
+
+	i = fdt_index_node_find_(idx, nodeoffset);
+	if (i < 0)
+		return -FDT_ERR_BADSTATE;
+
+	if (idx->npath_strs && (nodes[i].path >= 0)
+	    && (nodes[i].pathlen < buflen)) {
+		memcpy(buf, idx->npath_strs + nodes[i].path, nodes[i].pathlen);
+		buf[nodes[i].pathlen] = '\0';
+		return 0;
+	}
+
+	/*
+	 * Each name is followed by a '/', the last one is dropped. The
+	 * names are laid out from the end of the buffer, going up from
+	 * the node, then moved to its start.
+	 */
+	for (j = i, p = buflen; j >= 0; j = nodes[j].parent) {
+		name = fdt_get_name(fdt, nodes[j].offset, &len);
+		if (!name)
+			return -FDT_ERR_BADSTATE;
+		if (p < (len + 1))
+			return fdt_index_get_path_nospace_(idx, i, buf, buflen);
+		p -= len + 1;
+		memcpy(buf + p, name, len);
+		buf[p + len] = '/';
+	}
+
+	size = buflen - p;
+	memmove(buf, buf + p, size);
+
+	if (size > 1) /* special case so that root path is "/", not "" */
+		size--;
+	buf[size] = '\0';
+
+	if (idx->npath_strs && (size <= idx->npath_strsize)) {
+		if ((idx->npath_strused + size) > idx->npath_strsize)
+			fdt_index_node_paths_clear_(idx);
+		memcpy(idx->npath_strs + idx->npath_strused, buf, size);
+		nodes[i].path = idx->npath_strused;
+		nodes[i].pathlen = size;
+		idx->npath_strused += size;
+	}
+
+	return 0;
+}
+
+/**********************************************************************/
+/* Path cache                                                         */
+/**********************************************************************/
+
+static uint32_t fdt_index_path_hash_(const char *path, int len)
+{
+	uint32_t h = 2166136261U;
+
+	while (len--) {
+		h ^= (unsigned char)*path++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static int fdt_index_path_slot_(struct fdt_index *idx, const char *path,
+				int len, uint32_t hash)
+{
+	int h = hash & idx->path_mask;
+	int i;
+
+	while ((i = idx->path_slots[h]) >= 0) {
+		const struct fdt_index_path *e = &idx->path_ents[i];
+
+		if ((e->hash == hash) && (e->len == len)
+		    && (memcmp(idx->path_strs + e->str, path, len) == 0))
+			break;
+		h = (h + 1) & idx->path_mask;
+	}
+
+	return h;
+}
+
+static void fdt_index_paths_clear_(struct fdt_index *idx)
+{
+	int i;
+
+	for (i = 0; i <= idx->path_mask; i++)
+		idx->path_slots[i] = -1;
+	idx->path_count = 0;
+	idx->path_strused = 0;
+}
+
+int fdt_index_paths(struct fdt_index *idx, void *buf, int bufsize)
+{
+	unsigned int slotsize;
+	int nslots;
+
+	FDT_RO_PROBE(idx->fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	idx->path_slots = NULL;
+
+	/*
+	 * Half of the memory holds the hash table, with half of its slots
+	 * kept free, and the other half the path strings.
+	 */
+	slotsize = sizeof(int) + sizeof(struct fdt_index_path) / 2;
+	if ((bufsize < 0) || ((unsigned)bufsize < (4 * slotsize)))
+		return -FDT_ERR_NOSPACE;
+	for (nslots = 2; (nslots * 2 * slotsize) <= ((unsigned)bufsize / 2);
+	     nslots *= 2)
+		;
+
+	idx->path_mask = nslots - 1;
+	idx->path_max = nslots / 2;
+	idx->path_ents = (struct fdt_index_path *)
+		((char *)buf + nslots * sizeof(int));
+	idx->path_strs = (char *)(idx->path_ents + idx->path_max);
+	idx->path_strsize = (char *)buf + bufsize - idx->path_strs;
+	idx->path_slots = buf;
+	fdt_index_paths_clear_(idx);
+	return 0;
+}
+
+int fdt_index_path_offset_(struct fdt_index *idx, const char *path, int len)
+{
+	int h, offset;
+
+	if (!idx->path_slots)
+		return -FDT_ERR_BADSTATE;
+
+	h = fdt_index_path_slot_(idx, path, len,
+				 fdt_index_path_hash_(path, len));
+	if (idx->path_slots[h] < 0)
+		return -FDT_ERR_BADSTATE;
+
+	offset = idx->path_ents[idx->path_slots[h]].offset;
+	return (offset < 0) ? -FDT_ERR_BADSTATE : offset;
+}
+
+void fdt_index_path_add_(struct fdt_index *idx, const char *path, int len,
+			 int offset)
+{
+	struct fdt_index_path *e;
+	uint32_t hash;
+	int h;
+
+	if (!idx->path_slots)
+		return;
+
+	hash = fdt_index_path_hash_(path, len);
+	h = fdt_index_path_slot_(idx, path, len, hash);
+	if (idx->path_slots[h] >= 0) {
+		idx->path_ents[idx->path_slots[h]].offset = offset;
+		return;
+	}
+
+	/* Once full, the cache simply stops learning new paths */
+	if ((idx->path_count >= idx->path_max)
+	    || (len > (idx->path_strsize - idx->path_strused)))
+		return;
+
+	e = &idx->path_ents[idx->path_count];
+	e->hash = hash;
+	e->offset = offset;
+	e->str = idx->path_strused;
+	e->len = len;
+	memcpy(idx->path_strs + e->str, path, len);
+	idx->path_strused += len;
+	idx->path_slots[h] = idx->path_count++;
+}
+
+/*
+ * A new child of @parentoffset is looked at before its older siblings,
+ * so a path which went through the parent may now resolve elsewhere
+ * (e.g. "/soc/uart" once a "uart" node appears in front of "uart@0").
+ */
+static void fdt_index_paths_node_added_(void *fdt, struct fdt_index *idx,
+					int parentoffset)
+{
+	int end = -1, i;
+
+	for (i = 0; i < idx->path_count; i++) {
+		struct fdt_index_path *e = &idx->path_ents[i];
+
+		if (e->offset <= parentoffset)
+			continue;
+
+		if (end < 0) {
+			end = fdt_node_end_offset_(fdt, parentoffset);
+			if (end < 0) {
+				fdt_index_paths_clear_(idx);
+				return;
+			}
+		}
+
+		if (e->offset < end)
+			e->offset = -1;
+	}
+}
+
+/**********************************************************************/
+/* Strings table                                                      */
+/**********************************************************************/
+
+/*
+ * fdt_find_string_() returns the first place the string occurs, which
+ * may be the tail of a longer name, so every suffix of every string is
+ * a key. Hashing from the end gives all suffixes of a string in one
+ * pass.
+ *
+ * While a blob is built with the sequential write functions, its
+ * strings grow downwards from the end of the buffer and offsets are
+ * negative, relative to that end. Either way the lowest offset is the
+ * one a scan finds first.
+ */
+static inline uint32_t fdt_index_string_step_(uint32_t h, char c)
+{
+	return (unsigned char)c + 31 * h;
+}
+
+static inline int fdt_index_string_hash_(uint32_t h, int mask)
+{
+	h ^= h >> 16;
+	h *= 0x45d9f3bU;
+	h ^= h >> 16;
+	return h & mask;
+}
+
+static int fdt_index_sw_(const void *fdt)
+{
+	return fdt_magic(fdt) == FDT_SW_MAGIC;
+}
+
+static const char *fdt_index_strtab_(const struct fdt_index *idx)
+{
+	if (fdt_index_sw_(idx->fdt))
+		return (const char *)idx->fdt + fdt_totalsize(idx->fdt);
+
+	return (const char *)idx->fdt + fdt_off_dt_strings(idx->fdt);
+}
+
+/*
+ * Slot holding @s (@len bytes including the terminator), or a free one.
+ * @s itself need not be terminated.
+ */
+static int fdt_index_string_slot_(const struct fdt_index *idx,
+				  const char *s, int len, uint32_t hash)
+{
+	const char *strtab = fdt_index_strtab_(idx);
+	int h = fdt_index_string_hash_(hash, idx->str_mask);
+	int i;
+
+	while ((i = idx->str_slots[h]) >= 0) {
+		const struct fdt_index_string *e = &idx->str_ents[i];
+
+		/*
+		 * The stored string is terminated within the block, so
+		 * strncmp() stops at its end if it is the shorter one.
+		 */
+		if ((e->hash == hash)
+		    && (strncmp(strtab + e->offset, s, len - 1) == 0)
+		    && (strtab[e->offset + len - 1] == '\0'))
+			break;
+		h = (h + 1) & idx->str_mask;
+	}
+
+	return h;
+}
+
+/* Record the suffixes of the string running from @start to @end */
+static int fdt_index_string_insert_(struct fdt_index *idx, int start,
+				    int end)
+{
+	const char *strtab = fdt_index_strtab_(idx);
+	uint32_t hash = 0;
+	int p, h;
+
+	for (p = end; p >= start; p--) {
+		struct fdt_index_string *e;
+
+		if (p < end)
+			hash = fdt_index_string_step_(hash, strtab[p]);
+
+		h = fdt_index_string_slot_(idx, strtab + p, end - p + 1,
+					   hash);
+		if (idx->str_slots[h] >= 0) {
+			/* The occurrence a scan would find first wins */
+			e = &idx->str_ents[idx->str_slots[h]];
+			if (p < e->offset)
+				e->offset = p;
+			continue;
+		}
+
+		if (idx->str_count >= idx->str_max)
+			return -FDT_ERR_NOSPACE;
+
+		e = &idx->str_ents[idx->str_count];
+		e->hash = hash;
+		e->offset = p;
+		idx->str_slots[h] = idx->str_count++;
+	}
+
+	return 0;
+}
+
+static int fdt_index_strings_build_(struct fdt_index *idx)
+{
+	const char *strtab = fdt_index_strtab_(idx);
+	int size = fdt_size_dt_strings(idx->fdt);
+	int start = fdt_index_sw_(idx->fdt) ? -size : 0;
+	int end = start + size;
+	const char *q;
+	int p, i, err;
+
+	for (i = 0; i <= idx->str_mask; i++)
+		idx->str_slots[i] = -1;
+	idx->str_count = 0;
+
+	/* Bytes after the last terminator can never match */
+	for (p = start; (p < end) && (q = memchr(strtab + p, '\0', end - p));
+	     p = q - strtab + 1) {
+		err = fdt_index_string_insert_(idx, p, q - strtab);
+		if (err) {
+			idx->str_slots = NULL;
+			return err;
+		}
+	}
+
+	idx->str_size = size;
+	return 0;
+}
+
+int fdt_index_strings(struct fdt_index *idx, void *buf, int bufsize)
+{
+	unsigned int slotsize;
+	int nslots;
+
+	if (!fdt_index_sw_(idx->fdt))
+		FDT_RO_PROBE(idx->fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	idx->str_slots = NULL;
+
+	/* Half of the hash slots stay free, to keep probe chains short */
+	slotsize = sizeof(int) + sizeof(struct fdt_index_string) / 2;
+	if ((bufsize < 0) || ((unsigned)bufsize < (2 * slotsize)))
+		return -FDT_ERR_NOSPACE;
+	for (nslots = 2; (nslots * 2 * slotsize) <= (unsigned)bufsize;
+	     nslots *= 2)
+		;
+
+	idx->str_mask = nslots - 1;
+	idx->str_max = nslots / 2;
+	idx->str_ents = (struct fdt_index_string *)
+		((char *)buf + nslots * sizeof(int));
+	idx->str_slots = buf;
+	return fdt_index_strings_build_(idx);
+}
+
+int fdt_index_string_find_(struct fdt_index *idx, const char *s, int len,
+			   int *offset)
+{
+	uint32_t hash = 0;
+	int h, i;
+
+	if (!idx->str_slots
+	    || (idx->str_size != (int)fdt_size_dt_strings(idx->fdt)))
+		return -FDT_ERR_BADSTATE;
+
+	for (i = len - 2; i >= 0; i--)
+		hash = fdt_index_string_step_(hash, s[i]);
+
+	h = fdt_index_string_slot_(idx, s, len, hash);
+	if (idx->str_slots[h] < 0)
+		return -FDT_ERR_NOTFOUND;
+
+	*offset = idx->str_ents[idx->str_slots[h]].offset;
+	return 0;
+}
+
+/**********************************************************************/
+/* Symbols table                                                      */
+/**********************************************************************/
+
+/*
+ * The properties of /__symbols__, by name. Their offsets are kept
+ * relative to the node, so that edits elsewhere in the tree only move
+ * the node itself. Edits to its properties mark the table stale, and
+ * the next lookup in the node reads it again: applying an overlay adds
+ * a few symbols, and the fixups of the next overlay pay for one pass
+ * over the node rather than one per label.
+ */
+static int fdt_index_symbol_slot_(const struct fdt_index *idx,
+				  const char *name, int namelen, uint32_t hash)
+{
+	const void *fdt = idx->fdt;
+	int h = hash & idx->sym_mask;
+	int i;
+
+	while ((i = idx->sym_slots[h]) >= 0) {
+		const struct fdt_index_symbol *e = &idx->sym_ents[i];
+
+		if (e->hash == hash) {
+			const struct fdt_property *prop;
+			const char *s;
+			int slen;
+
+			prop = fdt_offset_ptr_(fdt, idx->sym_node + e->offset);
+			s = fdt_get_string(fdt, fdt32_ld_(&prop->nameoff),
+					   &slen);
+			if (s && (slen == namelen)
+			    && (memcmp(s, name, namelen) == 0))
+				break;
+		}
+		h = (h + 1) & idx->sym_mask;
+	}
+
+	return h;
+}
+
+static int fdt_index_symbols_build_(struct fdt_index *idx)
+{
+	const void *fdt = idx->fdt;
+	int offset, i;
+
+	for (i = 0; i <= idx->sym_mask; i++)
+		idx->sym_slots[i] = -1;
+	idx->sym_count = 0;
+	idx->sym_stale = 0;
+
+	if (idx->sym_node < 0)
+		return 0;
+
+	fdt_for_each_property_offset(offset, fdt, idx->sym_node) {
+		const struct fdt_property *prop;
+		struct fdt_index_symbol *e;
+		const char *name;
+		uint32_t hash;
+		int namelen, h;
+
+		prop = fdt_get_property_by_offset(fdt, offset, &namelen);
+		if (!prop)
+			return namelen;
+		name = fdt_get_string(fdt, fdt32_ld_(&prop->nameoff),
+				      &namelen);
+		if (!name)
+			return namelen;
+
+		/* Labels are hashed like paths. The first one wins */
+		hash = fdt_index_path_hash_(name, namelen);
+		h = fdt_index_symbol_slot_(idx, name, namelen, hash);
+		if (idx->sym_slots[h] >= 0)
+			continue;
+
+		if (idx->sym_count >= idx->sym_max)
+			return -FDT_ERR_NOSPACE;
+
+		e = &idx->sym_ents[idx->sym_count];
+		e->hash = hash;
+		e->offset = offset - idx->sym_node;
+		idx->sym_slots[h] = idx->sym_count++;
+	}
+
+	return (offset == -FDT_ERR_NOTFOUND) ? 0 : offset;
+}
+
+/* Look for /__symbols__ again, leaving the table to be read again */
+static int fdt_index_symbols_find_(struct fdt_index *idx)
+{
+	int offset = fdt_subnode_offset(idx->fdt, 0, "__symbols__");
+
+	if ((offset < 0) && (offset != -FDT_ERR_NOTFOUND)) {
+		idx->sym_slots = NULL;
+		return offset;
+	}
+
+	idx->sym_node = (offset < 0) ? -1 : offset;
+	idx->sym_stale = 1;
+	return 0;
+}
+
+int fdt_index_symbols(struct fdt_index *idx, void *buf, int bufsize)
+{
+	unsigned int slotsize;
+	int nslots, err;
+
+	FDT_RO_PROBE(idx->fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	idx->sym_slots = NULL;
+
+	/* Half of the hash slots stay free, to keep probe chains short */
+	slotsize = sizeof(int) + sizeof(struct fdt_index_symbol) / 2;
+	if ((bufsize < 0) || ((unsigned)bufsize < (2 * slotsize)))
+		return -FDT_ERR_NOSPACE;
+	for (nslots = 2; (nslots * 2 * slotsize) <= (unsigned)bufsize;
+	     nslots *= 2)
+		;
+
+	idx->sym_mask = nslots - 1;
+	idx->sym_max = nslots / 2;
+	idx->sym_ents = (struct fdt_index_symbol *)
+		((char *)buf + nslots * sizeof(int));
+	idx->sym_slots = buf;
+
+	err = fdt_index_symbols_find_(idx);
+	if (err)
+		return err;
+
+	err = fdt_index_symbols_build_(idx);
+	if (err)
+		idx->sym_slots = NULL;
+	return err;
+}
+
+int fdt_index_symbol_find_(struct fdt_index *idx, int nodeoffset,
+			   const char *name, int namelen)
+{
+	int h;
+
+	if (!idx->sym_slots || (idx->sym_node < 0)
+	    || (nodeoffset != idx->sym_node))
+		return -FDT_ERR_BADSTATE;
+
+	if (idx->sym_stale && fdt_index_symbols_build_(idx)) {
+		idx->sym_slots = NULL;
+		return -FDT_ERR_BADSTATE;
+	}
+
+	h = fdt_index_symbol_slot_(idx, name, namelen,
+				   fdt_index_path_hash_(name, namelen));
+	if (idx->sym_slots[h] < 0)
+		return -FDT_ERR_NOTFOUND;
+
+	return idx->sym_node + idx->sym_ents[idx->sym_slots[h]].offset;
+}
+
+/**********************************************************************/
+/* Property tables                                                    */
+/**********************************************************************/
+
+/*
+ * The properties of a node, sorted by the offset of their name in the
+ * strings block. Names are keyed on the first occurrence of the string,
+ * as found by the strings table, so that properties whose names are
+ * stored twice, or as the tail of a longer name, still match. Offsets
+ * are kept relative to the node, which the node table keeps in step
+ * with the edits; an edit within the node has its table read again.
+ */
+static void fdt_index_props_clear_(struct fdt_index *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->node_count; i++)
+		idx->nodes[i].props = -1;
+	idx->prop_count = 0;
+}
+
+static int fdt_index_props_read_(struct fdt_index *idx, int i)
+{
+	const void *fdt = idx->fdt;
+	int nodeoffset = idx->nodes[i].offset;
+	int start = idx->prop_count;
+	int offset;
+
+	fdt_for_each_property_offset(offset, fdt, nodeoffset) {
+		const struct fdt_property *prop;
+		const char *name;
+		int namelen, nameoff, j, err;
+
+		if (idx->prop_count >= idx->prop_max) {
+			/* Start over, unless this node alone is too big */
+			if (start == 0)
+				return -FDT_ERR_NOSPACE;
+			fdt_index_props_clear_(idx);
+			return fdt_index_props_read_(idx, i);
+		}
+
+		prop = fdt_get_property_by_offset(fdt, offset, &namelen);
+		if (!prop)
+			return namelen;
+		name = fdt_get_string(fdt, fdt32_ld_(&prop->nameoff),
+				      &namelen);
+		if (!name)
+			return namelen;
+		err = fdt_index_string_find_(idx, name, namelen + 1, &nameoff);
+		if (err)
+			return err;
+
+		/* Insertion keeps the first of two equal names first */
+		for (j = idx->prop_count;
+		     (j > start) && (idx->props[j - 1].nameoff > nameoff); j--)
+			idx->props[j] = idx->props[j - 1];
+		idx->props[j].nameoff = nameoff;
+		idx->props[j].offset = offset - nodeoffset;
+		idx->prop_count++;
+	}
+
+	if (offset != -FDT_ERR_NOTFOUND)
+		return offset;
+
+	idx->nodes[i].props = start;
+	idx->nodes[i].nprops = idx->prop_count - start;
+	return 0;
+}
+
+int fdt_index_props(struct fdt_index *idx, void *buf, int bufsize)
+{
+	FDT_RO_PROBE(idx->fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+	if (bufsize < 0)
+		return -FDT_ERR_NOSPACE;
+
+	idx->props = NULL;
+	if (!idx->nodes || !idx->str_slots)
+		return -FDT_ERR_BADSTATE;
+
+	idx->props = buf;
+	idx->prop_max = bufsize / sizeof(*idx->props);
+	fdt_index_props_clear_(idx);
+	return 0;
+}
+
+int fdt_index_prop_find_(struct fdt_index *idx, int nodeoffset,
+			 const char *name, int namelen)
+{
+	const struct fdt_index_node *node;
+	const struct fdt_index_prop *props;
+	int i, nameoff, lo, hi, err;
+
+	if (!idx->props || !idx->str_slots)
+		return -FDT_ERR_BADSTATE;
+
+	i = fdt_index_node_find_(idx, nodeoffset);
+	if (i < 0)
+		return -FDT_ERR_BADSTATE;
+
+	/* No property can have a name missing from the strings block */
+	err = fdt_index_string_find_(idx, name, namelen + 1, &nameoff);
+	if (err)
+		return err;
+
+	node = &idx->nodes[i];
+	if ((node->props < 0) && fdt_index_props_read_(idx, i))
+		return -FDT_ERR_BADSTATE;
+
+	props = &idx->props[node->props];
+	lo = 0;
+	hi = node->nprops;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (props[mid].nameoff < nameoff)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo >= node->nprops) || (props[lo].nameoff != nameoff))
+		return -FDT_ERR_NOTFOUND;
+
+	return nodeoffset + props[lo].offset;
+}
+
+/**********************************************************************/
+/* Property value tables                                              */
+/**********************************************************************/
+
+/*
+ * The nodes holding each value of one property, in tree order. Values
+ * are kept as offsets of one occurrence in the structure block, hashed
+ * like paths; the compatible table keys each string of the list
+ * instead of the whole value. A lookup remembers where it stopped in
+ * the list, so that walking through the matches from one to the next
+ * does not rescan the list. Node offsets follow the splices; any edit
+ * to the property, or which removes a node, has the tree read again on
+ * the next lookup.
+ */
+static int fdt_index_values_slot_(const void *fdt,
+				  const struct fdt_index_values *t,
+				  const char *val, int len, uint32_t hash)
+{
+	int h = hash & t->mask;
+	int i;
+
+	while ((i = t->slots[h]) >= 0) {
+		const struct fdt_index_value *e = &t->ents[i];
+
+		if ((e->hash == hash) && (e->len == len)
+		    && (memcmp(fdt_offset_ptr_(fdt, e->val), val, len) == 0))
+			break;
+		h = (h + 1) & t->mask;
+	}
+
+	return h;
+}
+
+static int fdt_index_values_add_(const void *fdt, struct fdt_index_values *t,
+				 int nodeoffset, const char *val, int len)
+{
+	struct fdt_index_value_node *n;
+	struct fdt_index_value *e;
+	uint32_t hash = fdt_index_path_hash_(val, len);
+	int h = fdt_index_values_slot_(fdt, t, val, len, hash);
+
+	if (t->slots[h] < 0) {
+		if (t->count >= t->max)
+			return -FDT_ERR_NOSPACE;
+
+		e = &t->ents[t->count];
+		e->hash = hash;
+		e->val = val - (const char *)fdt_offset_ptr_(fdt, 0);
+		e->len = len;
+		e->first = e->last = e->cursor = -1;
+		t->slots[h] = t->count++;
+	}
+
+	/* A string listed twice by a node still names it once */
+	e = &t->ents[t->slots[h]];
+	if ((e->last >= 0) && (t->nodes[e->last].offset == nodeoffset))
+		return 0;
+
+	if (t->node_count >= t->node_max)
+		return -FDT_ERR_NOSPACE;
+
+	n = &t->nodes[t->node_count];
+	n->offset = nodeoffset;
+	n->next = -1;
+	if (e->last >= 0)
+		t->nodes[e->last].next = t->node_count;
+	else
+		e->first = t->node_count;
+	e->last = t->node_count++;
+	return 0;
+}
+
+static int fdt_index_values_read_(const void *fdt, struct fdt_index_values *t,
+				  int nodeoffset)
+{
+	const char *list, *end, *p, *q;
+	int len, err;
+
+	/*
+	 * fdt_node_offset_by_prop_value() skips the nodes it can't read
+	 * the property of, fdt_node_offset_by_compatible() stops there.
+	 */
+	list = fdt_getprop_namelen(fdt, nodeoffset, t->name, t->namelen,
+				   &len);
+	if (!list)
+		return (t->split && (len != -FDT_ERR_NOTFOUND)) ? len : 0;
+
+	if (!t->split)
+		return fdt_index_values_add_(fdt, t, nodeoffset, list, len);
+
+	/*
+	 * fdt_stringlist_contains() matches an unterminated last string
+	 * when the byte after the value happens to end it.
+	 */
+	end = list + len;
+	if (fdt_offset_ptr(fdt, end - (const char *)fdt_offset_ptr_(fdt, 0),
+			   1) && !*end)
+		end++;
+
+	/* Empty strings are left to the scan, see fdt_index_compatible_next_ */
+	for (p = list; (p < end) && (q = memchr(p, '\0', end - p));
+	     p = q + 1) {
+		if (q == p)
+			continue;
+		err = fdt_index_values_add_(fdt, t, nodeoffset, p, q - p);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static int fdt_index_values_build_(const void *fdt,
+				   struct fdt_index_values *t)
+{
+	int offset, i, err;
+
+	for (i = 0; i <= t->mask; i++)
+		t->slots[i] = -1;
+	t->count = 0;
+	t->node_count = 0;
+	t->stale = 0;
+
+	for (offset = fdt_next_node(fdt, -1, NULL);
+	     offset >= 0;
+	     offset = fdt_next_node(fdt, offset, NULL)) {
+		err = fdt_index_values_read_(fdt, t, offset);
+		if (err)
+			return err;
+	}
+
+	return (offset == -FDT_ERR_NOTFOUND) ? 0 : offset;
+}
+
+static int fdt_index_values_init_(const void *fdt, struct fdt_index_values *t,
+				  void *buf, int bufsize)
+{
+	unsigned int slotsize;
+	int nslots, err;
+
+	/*
+	 * Half of the hash slots stay free, to keep probe chains short.
+	 * The slots and values take up to half of the memory, the node
+	 * lists the rest.
+	 */
+	slotsize = sizeof(int) + sizeof(struct fdt_index_value) / 2;
+	if ((bufsize < 0) || ((unsigned)bufsize < (4 * slotsize)))
+		return -FDT_ERR_NOSPACE;
+	for (nslots = 2; (nslots * 4 * slotsize) <= (unsigned)bufsize;
+	     nslots *= 2)
+		;
+
+	t->mask = nslots - 1;
+	t->max = nslots / 2;
+	t->ents = (struct fdt_index_value *)
+		((char *)buf + nslots * sizeof(int));
+	t->nodes = (struct fdt_index_value_node *)
+		((char *)buf + nslots * slotsize);
+	t->node_max = (bufsize - nslots * slotsize)
+		/ sizeof(struct fdt_index_value_node);
+	t->slots = buf;
+
+	err = fdt_index_values_build_(fdt, t);
+	if (err)
+		t->slots = NULL;
+	return err;
+}
+
+/* First node after @startoffset holding @val, or -FDT_ERR_BADSTATE */
+static int fdt_index_values_next_(const void *fdt, struct fdt_index_values *t,
+				  int startoffset, const char *val, int len)
+{
+	const struct fdt_index_value_node *nodes;
+	struct fdt_index_value *e;
+	int h, i;
+
+	if (t->stale && fdt_index_values_build_(fdt, t)) {
+		t->slots = NULL;
+		return -FDT_ERR_BADSTATE;
+	}
+
+	h = fdt_index_values_slot_(fdt, t, val, len,
+				   fdt_index_path_hash_(val, len));
+	if (t->slots[h] < 0)
+		return -FDT_ERR_NOTFOUND;
+
+	e = &t->ents[t->slots[h]];
+	nodes = t->nodes;
+	i = e->first;
+	if ((e->cursor >= 0) && (nodes[e->cursor].offset <= startoffset))
+		i = e->cursor;
+	while ((i >= 0) && (nodes[i].offset <= startoffset))
+		i = nodes[i].next;
+
+	if (i < 0)
+		return -FDT_ERR_NOTFOUND;
+
+	e->cursor = i;
+	return nodes[i].offset;
+}
+
+static void fdt_index_values_splice_(struct fdt_index_values *t, int offset,
+				     int oldlen, int newlen)
+{
+	int i;
+
+	if (!t->slots || t->stale)
+		return;
+
+	for (i = 0; i < t->count; i++)
+		if (fdt_index_shift_(&t->ents[i].val, offset, oldlen, newlen))
+			t->stale = 1;
+	for (i = 0; i < t->node_count; i++)
+		if (fdt_index_shift_(&t->nodes[i].offset, offset, oldlen,
+				     newlen))
+			t->stale = 1;
+}
+
+int fdt_index_compatibles(struct fdt_index *idx, void *buf, int bufsize)
+{
+	FDT_RO_PROBE(idx->fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	idx->compat.slots = NULL;
+	idx->compat.name = "compatible";
+	idx->compat.namelen = strlen(idx->compat.name);
+	idx->compat.split = 1;
+	return fdt_index_values_init_(idx->fdt, &idx->compat, buf, bufsize);
+}
+
+int fdt_index_compatible_next_(struct fdt_index *idx, int startoffset,
+			       const char *compatible)
+{
+	int len = strlen(compatible);
+
+	/*
+	 * "" matches a node by the bytes around its strings rather than
+	 * by the strings themselves, which is not worth keeping track of.
+	 */
+	if (!idx->compat.slots || !len)
+		return -FDT_ERR_BADSTATE;
+
+	return fdt_index_values_next_(idx->fdt, &idx->compat, startoffset,
+				      compatible, len);
+}
+
+static struct fdt_index_values *fdt_index_values_get_(struct fdt_index *idx,
+						      const char *name,
+						      int namelen)
+{
+	int i;
+
+	for (i = 0; i < FDT_INDEX_MAX_VALUES; i++) {
+		struct fdt_index_values *t = &idx->values[i];
+
+		if (t->name && (t->namelen == namelen)
+		    && (memcmp(t->name, name, namelen) == 0))
+			return t;
+	}
+
+	return NULL;
+}
+
+int fdt_index_prop_values(struct fdt_index *idx, const char *name,
+			  void *buf, int bufsize)
+{
+	struct fdt_index_values *t;
+	int namelen = strlen(name);
+	int namesize = FDT_TAGALIGN(namelen + 1);
+	int i, err;
+
+	FDT_RO_PROBE(idx->fdt);
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	t = fdt_index_values_get_(idx, name, namelen);
+	for (i = 0; !t && (i < FDT_INDEX_MAX_VALUES); i++)
+		if (!idx->values[i].name)
+			t = &idx->values[i];
+	if (!t)
+		return -FDT_ERR_NOSPACE;
+
+	t->name = NULL;
+	t->slots = NULL;
+	if ((bufsize < 0) || (bufsize < namesize))
+		return -FDT_ERR_NOSPACE;
+
+	/* The name is kept at the start of @buf, the table after it */
+	memcpy(buf, name, namelen + 1);
+	t->name = buf;
+	t->namelen = namelen;
+	t->split = 0;
+	err = fdt_index_values_init_(idx->fdt, t, (char *)buf + namesize,
+				     bufsize - namesize);
+	if (err)
+		t->name = NULL;
+	return err;
+}
+
+int fdt_index_prop_value_next_(struct fdt_index *idx, int startoffset,
+			       const char *propname, const void *propval,
+			       int proplen)
+{
+	struct fdt_index_values *t;
+
+	t = fdt_index_values_get_(idx, propname, strlen(propname));
+	if (!t || !t->slots)
+		return -FDT_ERR_BADSTATE;
+
+	return fdt_index_values_next_(idx->fdt, t, startoffset, propval,
+				      proplen);
+}
+
+/**********************************************************************/
+/* Maintenance hooks for the read-write functions                     */
+/**********************************************************************/
+
+/*
+ * @oldlen bytes of the structure block at @offset were replaced by
+ * @newlen bytes. Nodes which started in the replaced region are gone;
+ * fdt_nop_node() reports itself with @oldlen == @newlen.
+ */
+void fdt_index_splice_(void *fdt, int offset, int oldlen, int newlen)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int i;
+
+	if (!idx)
+		return;
+
+	if (idx->nodes)
+		fdt_index_nodes_splice_(idx, offset, oldlen, newlen);
+
+	if (idx->ph_slots)
+		for (i = 0; i < idx->ph_count; i++) {
+			struct fdt_index_phandle *e = &idx->ph_ents[i];
+
+			if ((e->offset >= 0)
+			    && fdt_index_shift_(&e->offset, offset, oldlen,
+						newlen))
+				e->offset = -1;
+		}
+
+	if (idx->path_slots)
+		for (i = 0; i < idx->path_count; i++) {
+			struct fdt_index_path *e = &idx->path_ents[i];
+
+			if ((e->offset >= 0)
+			    && fdt_index_shift_(&e->offset, offset, oldlen,
+						newlen))
+				e->offset = -1;
+		}
+
+	if (idx->sym_slots && (idx->sym_node >= 0)
+	    && fdt_index_shift_(&idx->sym_node, offset, oldlen, newlen))
+		idx->sym_node = -1;
+	fdt_index_values_splice_(&idx->compat, offset, oldlen, newlen);
+	for (i = 0; i < FDT_INDEX_MAX_VALUES; i++)
+		fdt_index_values_splice_(&idx->values[i], offset, oldlen,
+					 newlen);
+}
+
+void fdt_index_node_added_(void *fdt, int parentoffset, int nodeoffset,
+			   int len)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	struct fdt_index_node *nodes;
+	int parent, pos, i;
+
+	if (!idx)
+		return;
+
+	if (idx->path_slots)
+		fdt_index_paths_node_added_(fdt, idx, parentoffset);
+
+	/* A root can't have two children of the same name added */
+	if (idx->sym_slots && (idx->sym_node < 0) && (parentoffset == 0)) {
+		const char *name = fdt_get_name(fdt, nodeoffset, NULL);
+
+		if (name && (strcmp(name, "__symbols__") == 0)) {
+			idx->sym_node = nodeoffset;
+			idx->sym_stale = 1;
+		}
+	}
+
+	if (!idx->nodes)
+		return;
+
+	nodes = idx->nodes;
+	parent = fdt_index_node_find_(idx, parentoffset);
+	if ((parent < 0) || (idx->node_count >= idx->node_max)) {
+		idx->nodes = NULL;
+		return;
+	}
+
+	/* The splice already moved the following nodes out of the way */
+	pos = fdt_index_node_bound_(idx, nodeoffset);
+	memmove(&nodes[pos + 1], &nodes[pos],
+		(idx->node_count - pos) * sizeof(*nodes));
+	idx->node_count++;
+
+	for (i = pos + 1; i < idx->node_count; i++)
+		if (nodes[i].parent >= pos)
+			nodes[i].parent++;
+
+	nodes[pos].offset = nodeoffset;
+	nodes[pos].parent = parent;
+	nodes[pos].depth = nodes[parent].depth + 1;
+	nodes[pos].end = nodeoffset + len;
+	nodes[pos].props = -1;
+	nodes[pos].nprops = 0;
+	nodes[pos].path = -1;
+}
+
+void fdt_index_node_renamed_(void *fdt, int nodeoffset)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+
+	if (!idx)
+		return;
+
+	/* Renames are rare, don't bother finding the affected paths */
+	if (idx->path_slots)
+		fdt_index_paths_clear_(idx);
+	if (idx->nodes && idx->npath_strs)
+		fdt_index_node_paths_clear_(idx);
+
+	if (idx->sym_slots
+	    && ((idx->sym_node < 0) || (nodeoffset == idx->sym_node)))
+		fdt_index_symbols_find_(idx);
+}
+
+/* A string of @len bytes, terminator included, was added at @stroffset */
+void fdt_index_string_added_(void *fdt, int stroffset, int len)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int oldsize;
+
+	if (!idx || !idx->str_slots)
+		return;
+
+	oldsize = fdt_index_sw_(fdt) ? (-stroffset - len) : stroffset;
+	if ((idx->str_size != oldsize)
+	    || fdt_index_string_insert_(idx, stroffset, stroffset + len - 1)) {
+		idx->str_slots = NULL;
+		return;
+	}
+
+	idx->str_size = oldsize + len;
+}
+
+/*
+ * The last string was dropped again. When appending, its suffixes were
+ * the last keys added, so no other key's probe chain runs through
+ * their slots and they can simply be emptied. The sequential write
+ * functions prepend strings, which may have taken over older keys, so
+ * there the table is rebuilt.
+ */
+void fdt_index_strings_trimmed_(void *fdt)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int size = fdt_size_dt_strings(fdt);
+
+	if (!idx || !idx->str_slots)
+		return;
+
+	if (fdt_index_sw_(fdt)) {
+		fdt_index_strings_build_(idx);
+		return;
+	}
+
+	while ((idx->str_count > 0)
+	       && (idx->str_ents[idx->str_count - 1].offset >= size)) {
+		const struct fdt_index_string *e =
+			&idx->str_ents[--idx->str_count];
+		int h = fdt_index_string_hash_(e->hash, idx->str_mask);
+
+		while (idx->str_slots[h] != idx->str_count)
+			h = (h + 1) & idx->str_mask;
+		idx->str_slots[h] = -1;
+	}
+
+	idx->str_size = size;
+}
+
+/*
+ * fdt_finish() moved the strings of a sequentially written blob after
+ * the structure block, making their offsets relative to its start.
+ */
+void fdt_index_sw_finished_(void *fdt)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int i;
+
+	if (!idx || !idx->str_slots)
+		return;
+
+	for (i = 0; i < idx->str_count; i++)
+		idx->str_ents[i].offset += idx->str_size;
+}
+
+/* fdt_resize() moved a blob under construction to @buf */
+void fdt_index_moved_(void *fdt, void *buf)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+
+	if (idx)
+		idx->fdt = buf;
+}
+
+/* The blob was rewritten as a whole, see fdt_txn_commit() */
+void fdt_index_rebuild_(void *fdt)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int i;
+
+	if (!idx)
+		return;
+
+	/* Each table is built again in the memory it was given */
+	if (idx->ph_slots)
+		fdt_index_phandles(idx, idx->ph_slots,
+				   (idx->ph_mask + 1) * (sizeof(int)
+				   + sizeof(struct fdt_index_phandle) / 2));
+	if (idx->nodes)
+		fdt_index_nodes(idx, idx->nodes,
+				idx->node_max * sizeof(*idx->nodes));
+	if (idx->path_slots)
+		fdt_index_paths_clear_(idx);
+	if (idx->str_slots)
+		fdt_index_strings_build_(idx);
+	if (idx->sym_slots)
+		fdt_index_symbols_find_(idx);
+	if (idx->props)
+		idx->prop_count = 0;
+	if (idx->npath_strs)
+		idx->npath_strused = 0;
+	idx->compat.stale = 1;
+	for (i = 0; i < FDT_INDEX_MAX_VALUES; i++)
+		idx->values[i].stale = 1;
+}
+
+/*
+ * Property @name of @nodeoffset now holds @len bytes at @val. @val is
+ * NULL if the value is not known yet, and @len is negative if the
+ * property was removed.
+ */
+void fdt_index_prop_changed_(void *fdt, int nodeoffset, const char *name,
+			     int namelen, const void *val, int len)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	struct fdt_index_values *t;
+
+	if (!idx)
+		return;
+
+	if (idx->sym_slots && (nodeoffset == idx->sym_node))
+		idx->sym_stale = 1;
+
+	if (idx->compat.slots && (namelen == idx->compat.namelen)
+	    && (memcmp(name, idx->compat.name, namelen) == 0))
+		idx->compat.stale = 1;
+	t = fdt_index_values_get_(idx, name, namelen);
+	if (t)
+		t->stale = 1;
+
+	/* Splices are noticed anyway, but fdt_nop_property() is not one */
+	if (idx->props && (len < 0)) {
+		int i = fdt_index_node_find_(idx, nodeoffset);
+
+		if (i >= 0)
+			idx->nodes[i].props = -1;
+	}
+
+	/*
+	 * Stale entries need no care, fdt_index_phandle_offset_() checks
+	 * every hit against the tree. The node's phandle is read back
+	 * rather than taken from @val: with both properties present only
+	 * "phandle" counts, and removing it uncovers the other one.
+	 */
+	if (idx->ph_slots && fdt_index_is_phandle_name_(name, namelen)) {
+		uint32_t phandle;
+
+		if (!val && (len >= 0)) {
+			/* A verified hit could hide this node, give up */
+			idx->ph_slots = NULL;
+			return;
+		}
+
+		phandle = fdt_get_phandle(fdt, nodeoffset);
+		if (!phandle)
+			return;
+
+		fdt_index_phandle_note_(idx, phandle, nodeoffset);
+		if (idx->ph_highest_known && (phandle > idx->ph_highest))
+			idx->ph_highest = phandle;
+	}
+}
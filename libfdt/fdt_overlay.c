@@ -11,8 +11,552 @@
 
 #include "libfdt_internal.h"
 
+#define OVERLAY_TARGETS	16
+
+/*
+ * The targets of the fragments merged so far, in fragment order, so
+ * that each is only resolved once per overlay. Offsets in a
+ * transaction are stable, but in a blob edited in place those past an
+ * edited node move; see overlay_targets_edited(), and fdt_merge_node_()
+ * which is handed @target to keep up to date.
+ *
+ * The arrays take room for every fragment from the memory the tree was
+ * given, see overlay_targets_init(), and otherwise hold the first
+ * OVERLAY_TARGETS fragments on the stack.
+ */
+struct overlay_targets {
+	int *fragment;
+	int *target;
+	const char **path;
+	int count;
+	int max;
+};
+
+/*
+ * A dry run, see fdt_overlay_check(). The overlay is only read, so the
+ * values its phandles would be given are worked out where they matter,
+ * and where the application would stop on a missing label or target
+ * the problem is reported and the run goes on without it.
+ */
+struct overlay_check {
+	struct fdt_overlay_report *report;
+	uint32_t delta;		/* added to the overlay's own phandles */
+	int error;		/* first error the application would hit */
+};
+
+/*
+ * Scratch memory and threads to merge the fragments of an overlay with
+ * disjoint targets all at once, see fdt_overlay_apply_parallel().
+ */
+struct overlay_parallel {
+	void *buf;
+	int bufsize;
+	int threads;
+	int *nodes;	/* the __overlay__ node of each fragment */
+};
+
+/*
+ * The tree an overlay is applied to: either a blob edited in place, or
+ * a transaction recording the edits against a blob left untouched, in
+ * which case @base_max may point to the highest phandle of that blob.
+ * If @changes is set, every edit is recorded there before being made.
+ * If @check is set, the transaction is a dry run. If @parallel is set,
+ * the fragments of a blob edited in place may be merged all at once.
+ */
+struct overlay_tree {
+	void *fdt;
+	struct fdt_txn *txn;
+	const uint32_t *base_max;
+	struct overlay_targets *targets;
+	struct fdt_changeset *changes;
+	struct overlay_check *check;
+	struct overlay_parallel *parallel;
+};
+
+/*
+ * A changeset holds its records from the end of its memory downwards,
+ * so that reading them in address order undoes the newest edit first.
+ * Each record is followed by the path of the node, the name of the
+ * property (empty for a node), both NUL terminated, and the old value
+ * of a changed property, padded to a multiple of 4 bytes.
+ */
+#define OVERLAY_PROP_ADDED	1
+#define OVERLAY_PROP_CHANGED	2
+#define OVERLAY_NODE_ADDED	3
+
+struct overlay_change {
+	fdt32_t type;
+	fdt32_t pathlen;
+	fdt32_t namelen;
+	fdt32_t len;
+};
+
+/*
+ * fdt_setprop() and fdt_add_subnode() only ever splice the structure
+ * block between the start of the node they are given and its first
+ * subnode, so a recorded target moves iff it lies past that node.
+ */
+static void overlay_targets_edited(const struct overlay_tree *tree,
+				   int nodeoffset, int oldsize)
+{
+	struct overlay_targets *targets = tree->targets;
+	int delta, i;
+
+	if (!targets)
+		return;
+
+	delta = fdt_size_dt_struct(tree->fdt) - oldsize;
+	if (!delta)
+		return;
+
+	for (i = 0; i < targets->count; i++)
+		if (targets->target[i] > nodeoffset)
+			targets->target[i] += delta;
+}
+
+static const void *overlay_getprop(const struct overlay_tree *tree,
+				   int nodeoffset, const char *name, int *lenp)
+{
+	if (tree->txn)
+		return fdt_txn_getprop(tree->txn, nodeoffset, name, lenp);
+	return fdt_getprop(tree->fdt, nodeoffset, name, lenp);
+}
+
+static int overlay_path_offset(const struct overlay_tree *tree,
+			       const char *path)
+{
+	if (tree->txn)
+		return fdt_txn_path_offset(tree->txn, path);
+	return fdt_path_offset(tree->fdt, path);
+}
+
+static int overlay_subnode_offset(const struct overlay_tree *tree,
+				  int parentoffset, const char *name)
+{
+	if (tree->txn)
+		return fdt_txn_subnode_offset(tree->txn, parentoffset, name);
+	return fdt_subnode_offset(tree->fdt, parentoffset, name);
+}
+
+static int overlay_node_offset_by_phandle(const struct overlay_tree *tree,
+					  uint32_t phandle)
+{
+	if (tree->txn)
+		return fdt_txn_node_offset_by_phandle(tree->txn, phandle);
+	return fdt_node_offset_by_phandle(tree->fdt, phandle);
+}
+
+static uint32_t overlay_get_phandle(const struct overlay_tree *tree,
+				    int nodeoffset)
+{
+	if (tree->txn)
+		return fdt_txn_get_phandle(tree->txn, nodeoffset);
+	return fdt_get_phandle(tree->fdt, nodeoffset);
+}
+
+static int overlay_find_max_phandle(const struct overlay_tree *tree,
+				    uint32_t *phandle)
+{
+	if (tree->txn)
+		return fdt_txn_find_max_phandle_(tree->txn, tree->base_max,
+						 phandle);
+	return fdt_find_max_phandle(tree->fdt, phandle);
+}
+
+static const char *overlay_get_name(const struct overlay_tree *tree,
+				    int nodeoffset, int *lenp)
+{
+	if (tree->txn)
+		return fdt_txn_get_name(tree->txn, nodeoffset, lenp);
+	return fdt_get_name(tree->fdt, nodeoffset, lenp);
+}
+
+static int overlay_parent_offset(const struct overlay_tree *tree,
+				 int nodeoffset)
+{
+	if (tree->txn)
+		return fdt_txn_parent_offset(tree->txn, nodeoffset);
+	return fdt_parent_offset(tree->fdt, nodeoffset);
+}
+
+static int overlay_get_path(const struct overlay_tree *tree, int nodeoffset,
+			    char *buf, int buflen)
+{
+	if (tree->txn)
+		return fdt_txn_get_path(tree->txn, nodeoffset, buf, buflen);
+	return fdt_get_path(tree->fdt, nodeoffset, buf, buflen);
+}
+
+/**
+ * overlay_record - Record an edit in the changeset of a tree
+ * @tree: tree about to be edited
+ * @type: OVERLAY_PROP_ADDED, OVERLAY_PROP_CHANGED or OVERLAY_NODE_ADDED
+ * @nodeoffset: offset of the node edited, or added
+ * @pathlen: length of the path of the node, if already built, or -1;
+ *	updated. NULL to always build the path.
+ * @name: name of the property, or NULL for a node
+ * @val: old value of a changed property
+ * @len: length of @val
+ *
+ * The path of the node is built at the start of the free memory of the
+ * changeset, then copied into the record, which takes the end of it.
+ * Records never reach into the path, so it is left there for the next
+ * edit of the same node.
+ *
+ * returns:
+ *      0 on success, or if @tree has no changeset
+ *      -FDT_ERR_NOSPACE, the changeset is full
+ *      Negative error code on other failures
+ */
+static int overlay_record(const struct overlay_tree *tree, int type,
+			  int nodeoffset, int *pathlenp, const char *name,
+			  const void *val, int len)
+{
+	struct fdt_changeset *cs = tree->changes;
+	struct overlay_change *rec;
+	int pathlen, namelen, size, room;
+	char *p;
+	int ret;
+
+	if (!cs)
+		return 0;
+
+	room = cs->size - cs->used;
+	if (!pathlenp || (*pathlenp < 0)) {
+		ret = overlay_get_path(tree, nodeoffset, cs->buf, room);
+		if (ret)
+			return ret;
+		pathlen = strlen(cs->buf);
+		if (pathlenp)
+			*pathlenp = pathlen;
+	} else {
+		pathlen = *pathlenp;
+	}
+
+	namelen = name ? strlen(name) : 0;
+	size = sizeof(*rec) + FDT_TAGALIGN(pathlen + namelen + 2 + len);
+	if ((room - pathlen - 1) < size)
+		return -FDT_ERR_NOSPACE;
+
+	rec = (struct overlay_change *)(cs->buf + room - size);
+	rec->type = cpu_to_fdt32(type);
+	rec->pathlen = cpu_to_fdt32(pathlen);
+	rec->namelen = cpu_to_fdt32(namelen);
+	rec->len = cpu_to_fdt32(len);
+
+	p = (char *)(rec + 1);
+	memcpy(p, cs->buf, pathlen + 1);
+	p += pathlen + 1;
+	memcpy(p, name ? name : "", namelen + 1);
+	p += namelen + 1;
+	if (len)
+		memcpy(p, val, len);
+	memset(p + len, 0, (char *)rec + size - (p + len));
+
+	cs->used += size;
+	return 0;
+}
+
+/**
+ * overlay_report - Report a problem found by a dry run
+ * @tree: tree being checked
+ * @kind: FDT_OVERLAY_UNRESOLVED, FDT_OVERLAY_NO_TARGET or
+ *	FDT_OVERLAY_OVERWRITE
+ * @offset: offset the problem is at, see struct fdt_overlay_report
+ * @name: name involved, or NULL
+ * @err: error the application would return there, or 0
+ *
+ * returns:
+ *      0 to go on with the dry run
+ *      the non-zero value returned by the report callback
+ */
+static int overlay_report(const struct overlay_tree *tree, int kind,
+			  int offset, const char *name, int err)
+{
+	struct overlay_check *check = tree->check;
+	struct fdt_overlay_report *report = check->report;
+
+	if (!check->error)
+		check->error = err;
+
+	if (kind == FDT_OVERLAY_UNRESOLVED)
+		report->unresolved++;
+	else if (kind == FDT_OVERLAY_NO_TARGET)
+		report->missing++;
+	else
+		report->overwritten++;
+
+	if (report->fn)
+		return report->fn(report->ctx, kind, offset, name);
+	return 0;
+}
+
+/**
+ * overlay_record_prop - Record the setting of a property
+ * @tree: tree about to be edited
+ * @nodeoffset: offset of the node holding the property
+ * @pathlenp: length of the path of the node, see overlay_record()
+ * @name: name of the property
+ *
+ * On a dry run, the property is reported if the base already has it.
+ *
+ * returns:
+ *      0 on success, or if @tree has no changeset
+ *      Negative error code on failure
+ */
+static int overlay_record_prop(const struct overlay_tree *tree,
+			       int nodeoffset, int *pathlenp, const char *name)
+{
+	const void *val;
+	int len;
+
+	if (tree->check) {
+		const void *fdt = tree->txn->fdt;
+
+		/* nodes of the base keep their offsets in the transaction */
+		if ((nodeoffset < (int)fdt_size_dt_struct(fdt))
+		    && fdt_getprop(fdt, nodeoffset, name, NULL))
+			return overlay_report(tree, FDT_OVERLAY_OVERWRITE,
+					      nodeoffset, name, 0);
+		return 0;
+	}
+
+	if (!tree->changes)
+		return 0;
+
+	val = overlay_getprop(tree, nodeoffset, name, &len);
+	if (val)
+		return overlay_record(tree, OVERLAY_PROP_CHANGED, nodeoffset,
+				      pathlenp, name, val, len);
+	if (len != -FDT_ERR_NOTFOUND)
+		return len;
+
+	return overlay_record(tree, OVERLAY_PROP_ADDED, nodeoffset,
+			      pathlenp, name, NULL, 0);
+}
+
+static int overlay_setprop(const struct overlay_tree *tree, int nodeoffset,
+			   const char *name, const void *val, int len)
+{
+	int oldsize, ret;
+
+	if (tree->txn)
+		return fdt_txn_setprop(tree->txn, nodeoffset, name, val, len);
+
+	oldsize = fdt_size_dt_struct(tree->fdt);
+	ret = fdt_setprop(tree->fdt, nodeoffset, name, val, len);
+	overlay_targets_edited(tree, nodeoffset, oldsize);
+	return ret;
+}
+
+static int overlay_setprop_placeholder(const struct overlay_tree *tree,
+				       int nodeoffset, const char *name,
+				       int len, void **prop_data)
+{
+	int oldsize, ret;
+
+	if (tree->txn)
+		return fdt_txn_setprop_placeholder(tree->txn, nodeoffset, name,
+						   len, prop_data);
+
+	oldsize = fdt_size_dt_struct(tree->fdt);
+	ret = fdt_setprop_placeholder(tree->fdt, nodeoffset, name, len,
+				      prop_data);
+	overlay_targets_edited(tree, nodeoffset, oldsize);
+	return ret;
+}
+
+static int overlay_add_subnode(const struct overlay_tree *tree,
+			       int parentoffset, const char *name)
+{
+	int oldsize, ret;
+
+	if (tree->txn)
+		return fdt_txn_add_subnode(tree->txn, parentoffset, name);
+
+	oldsize = fdt_size_dt_struct(tree->fdt);
+	ret = fdt_add_subnode(tree->fdt, parentoffset, name);
+	overlay_targets_edited(tree, parentoffset, oldsize);
+	return ret;
+}
+
+/**
+ * overlay_symbol_phandle - Find the phandle of a labelled base node
+ * @tree: Base device tree
+ * @symbols_off: Node offset of the symbols node in the base device tree
+ * @label: Label of the node
+ * @phandle: Set to the phandle of the node
+ *
+ * overlay_symbol_phandle() looks @label up in the symbols node of the
+ * base device tree, and returns the phandle of the node it names.
+ *
+ * returns:
+ *      0 on success
+ *      Negative error code on failure
+ */
+static int overlay_symbol_phandle(const struct overlay_tree *tree,
+				  int symbols_off, const char *label,
+				  uint32_t *phandle)
+{
+	const char *symbol_path;
+	int symbol_off;
+	int prop_len;
+
+	if (symbols_off < 0)
+		return symbols_off;
+
+	symbol_path = overlay_getprop(tree, symbols_off, label, &prop_len);
+	if (!symbol_path)
+		return prop_len;
+
+	symbol_off = overlay_path_offset(tree, symbol_path);
+	if (symbol_off < 0)
+		return symbol_off;
+
+	*phandle = overlay_get_phandle(tree, symbol_off);
+	if (!*phandle)
+		return -FDT_ERR_NOTFOUND;
+
+	return 0;
+}
+
+/**
+ * overlay_fixup_parse - Split up the next fixup of a __fixups__ property
+ * @value: remaining fixups, moved past the one split up
+ * @len: length of the remaining fixups, reduced accordingly
+ * @path: set to the path of the node holding the phandle reference
+ * @path_len: set to the length of @path
+ * @name: set to the name of the property holding the reference
+ * @name_len: set to the length of @name
+ * @poffset: set to the offset of the reference within the property
+ *
+ * Each fixup is a string of the form "<path>:<property>:<offset>".
+ *
+ * returns:
+ *      0 on success
+ *      -FDT_ERR_BADOVERLAY, the fixup is malformed
+ */
+static int overlay_fixup_parse(const char **value, int *len,
+			       const char **path, uint32_t *path_len,
+			       const char **name, uint32_t *name_len,
+			       int *poffset)
+{
+	const char *fixup_end;
+	const char *fixup_str = *value;
+	uint32_t fixup_len;
+	char *sep, *endptr;
+
+	fixup_end = memchr(fixup_str, '\0', *len);
+	if (!fixup_end)
+		return -FDT_ERR_BADOVERLAY;
+	fixup_len = fixup_end - fixup_str;
+
+	*len -= fixup_len + 1;
+	*value += fixup_len + 1;
+
+	*path = fixup_str;
+	sep = memchr(fixup_str, ':', fixup_len);
+	if (!sep || *sep != ':')
+		return -FDT_ERR_BADOVERLAY;
+
+	*path_len = sep - *path;
+	if (*path_len == (fixup_len - 1))
+		return -FDT_ERR_BADOVERLAY;
+
+	fixup_len -= *path_len + 1;
+	*name = sep + 1;
+	sep = memchr(*name, ':', fixup_len);
+	if (!sep || *sep != ':')
+		return -FDT_ERR_BADOVERLAY;
+
+	*name_len = sep - *name;
+	if (!*name_len)
+		return -FDT_ERR_BADOVERLAY;
+
+	*poffset = strtoul(sep + 1, &endptr, 10);
+	if ((*endptr != '\0') || (endptr <= (sep + 1)))
+		return -FDT_ERR_BADOVERLAY;
+
+	return 0;
+}
+
+/**
+ * overlay_check_target_phandle - Work out a target phandle on a dry run
+ * @tree: Base device tree, being checked
+ * @fdto: Device tree overlay blob
+ * @fragment: node offset of the fragment in the overlay
+ * @phandle: target phandle as it stands in the overlay
+ *
+ * The phandles of the overlay are left as they are on a dry run, so
+ * the target phandle is the one the fixups would write, or the one the
+ * local fixups would shift, if either applies to it.
+ *
+ * returns:
+ *      the phandle the target property would hold
+ *      -1, if it would refer to a label missing from the base
+ */
+static uint32_t overlay_check_target_phandle(const struct overlay_tree *tree,
+					     const void *fdto, int fragment,
+					     uint32_t phandle)
+{
+	const void *fdt = tree->txn->fdt;
+	const struct overlay_tree base = {
+		(void *)(uintptr_t)fdt, NULL, NULL, NULL, NULL, NULL, NULL
+	};
+	const char *frag_name, *label, *value;
+	const fdt32_t *cells;
+	int frag_len, node, property, len, i;
+
+	frag_name = fdt_get_name(fdto, fragment, &frag_len);
+	if (!frag_name)
+		return phandle;
+
+	/* fixups are resolved against the base before anything is merged */
+	node = fdt_path_offset(fdto, "/__fixups__");
+	fdt_for_each_property_offset(property, fdto, node) {
+		value = fdt_getprop_by_offset(fdto, property, &label, &len);
+		while (value && (len > 0)) {
+			const char *path, *name;
+			uint32_t path_len, name_len, ph;
+			int poffset;
+
+			if (overlay_fixup_parse(&value, &len, &path, &path_len,
+						&name, &name_len, &poffset))
+				break;
+
+			if ((path_len != (uint32_t)frag_len + 1)
+			    || (path[0] != '/')
+			    || memcmp(path + 1, frag_name, frag_len)
+			    || (name_len != sizeof("target") - 1)
+			    || memcmp(name, "target", name_len) || poffset)
+				continue;
+
+			if (overlay_symbol_phandle(&base,
+					fdt_path_offset(fdt, "/__symbols__"),
+					label, &ph))
+				return (uint32_t)-1;
+			return ph;
+		}
+	}
+
+	node = fdt_path_offset(fdto, "/__local_fixups__");
+	if (node >= 0)
+		node = fdt_subnode_offset_namelen(fdto, node, frag_name,
+						  frag_len);
+	if (node < 0)
+		return phandle;
+
+	cells = fdt_getprop(fdto, node, "target", &len);
+	for (i = 0; cells && (i < (len / (int)sizeof(*cells))); i++)
+		if (!fdt32_to_cpu(cells[i]))
+			return phandle + tree->check->delta;
+
+	return phandle;
+}
+
 /**
  * overlay_get_target_phandle - retrieves the target phandle of a fragment
+ * @tree: Base device tree
  * @fdto: pointer to the device tree overlay blob
  * @fragment: node offset of the fragment in the overlay
  *
@@ -25,24 +569,31 @@
  *      0, if the phandle was not found
  *	-1, if the phandle was malformed
  */
-static uint32_t overlay_get_target_phandle(const void *fdto, int fragment)
+static uint32_t overlay_get_target_phandle(const struct overlay_tree *tree,
+					   const void *fdto, int fragment)
 {
 	const fdt32_t *val;
+	uint32_t phandle;
 	int len;
 
 	val = fdt_getprop(fdto, fragment, "target", &len);
 	if (!val)
 		return 0;
 
-	if ((len != sizeof(*val)) || (fdt32_to_cpu(*val) == (uint32_t)-1))
+	if (len != sizeof(*val))
 		return (uint32_t)-1;
 
-	return fdt32_to_cpu(*val);
+	phandle = fdt32_to_cpu(*val);
+	if (tree->check)
+		phandle = overlay_check_target_phandle(tree, fdto, fragment,
+						       phandle);
+
+	return phandle;
 }
 
 /**
  * overlay_get_target - retrieves the offset of a fragment's target
- * @fdt: Base device tree blob
+ * @tree: Base device tree
  * @fdto: Device tree overlay blob
  * @fragment: node offset of the fragment in the overlay
  * @pathp: pointer which receives the path of the target (or NULL)
@@ -55,15 +606,16 @@ static uint32_t overlay_get_target_phandle(const void *fdto, int fragment)
  *      the targeted node offset in the base device tree
  *      Negative error code on error
  */
-static int overlay_get_target(const void *fdt, const void *fdto,
-			      int fragment, char const **pathp)
+static int overlay_get_target(const struct overlay_tree *tree,
+			      const void *fdto, int fragment,
+			      char const **pathp)
 {
 	uint32_t phandle;
 	const char *path = NULL;
 	int path_len = 0, ret;
 
 	/* Try first to do a phandle based lookup */
-	phandle = overlay_get_target_phandle(fdto, fragment);
+	phandle = overlay_get_target_phandle(tree, fdto, fragment);
 	if (phandle == (uint32_t)-1)
 		return -FDT_ERR_BADPHANDLE;
 
@@ -72,11 +624,11 @@ static int overlay_get_target(const void *fdt, const void *fdto,
 		/* And then a path based lookup */
 		path = fdt_getprop(fdto, fragment, "target-path", &path_len);
 		if (path)
-			ret = fdt_path_offset(fdt, path);
+			ret = overlay_path_offset(tree, path);
 		else
 			ret = path_len;
 	} else
-		ret = fdt_node_offset_by_phandle(fdt, phandle);
+		ret = overlay_node_offset_by_phandle(tree, phandle);
 
 	/*
 	* If we haven't found either a target or a
@@ -99,12 +651,72 @@ static int overlay_get_target(const void *fdt, const void *fdto,
 	return ret;
 }
 
+/**
+ * overlay_target - retrieves the offset of a fragment's target, once
+ * @tree: Base device tree
+ * @fdto: Device tree overlay blob
+ * @fragment: node offset of the fragment in the overlay
+ * @pathp: pointer which receives the path of the target (or NULL)
+ *
+ * overlay_target() behaves like overlay_get_target(), but returns the
+ * target recorded for @fragment when there is one, and otherwise
+ * records the target it finds while there is room. Looking the record
+ * up is a binary search, as the fragments are recorded in order.
+ *
+ * returns:
+ *      the targeted node offset in the base device tree
+ *      Negative error code on error
+ */
+static int overlay_target(const struct overlay_tree *tree,
+			  const void *fdto, int fragment,
+			  char const **pathp)
+{
+	struct overlay_targets *targets = tree->targets;
+	const char *path;
+	int i = 0, n, ret;
+
+	if (targets) {
+		for (n = targets->count; n > 0; ) {
+			if (targets->fragment[i + n / 2] < fragment) {
+				i += n / 2 + 1;
+				n -= n / 2 + 1;
+			} else {
+				n /= 2;
+			}
+		}
+
+		if ((i < targets->count)
+		    && (targets->fragment[i] == fragment)) {
+			if (pathp)
+				*pathp = targets->path[i];
+			return targets->target[i];
+		}
+	}
+
+	ret = overlay_get_target(tree, fdto, fragment, &path);
+	if (ret < 0)
+		return ret;
+
+	/* Fragments come in order, anything else is left out */
+	if (targets && (i == targets->count) && (i < targets->max)) {
+		targets->count++;
+		targets->fragment[i] = fragment;
+		targets->target[i] = ret;
+		targets->path[i] = path;
+	}
+
+	if (pathp)
+		*pathp = path;
+	return ret;
+}
+
 /**
  * overlay_phandle_add_offset - Increases a phandle by an offset
  * @fdt: Base device tree blob
  * @node: Device tree overlay blob
  * @name: Name of the property to modify (phandle or linux,phandle)
  * @delta: offset to apply
+ * @dry: only check that the phandle can be increased
  *
  * overlay_phandle_add_offset() increments a node phandle by a given
  * offset.
@@ -114,7 +726,8 @@ static int overlay_get_target(const void *fdt, const void *fdto,
  *      Negative error code on error
  */
 static int overlay_phandle_add_offset(void *fdt, int node,
-				      const char *name, uint32_t delta)
+				      const char *name, uint32_t delta,
+				      bool dry)
 {
 	const fdt32_t *val;
 	uint32_t adj_val;
@@ -135,6 +748,9 @@ static int overlay_phandle_add_offset(void *fdt, int node,
 	if (adj_val == (uint32_t)-1)
 		return -FDT_ERR_NOPHANDLES;
 
+	if (dry)
+		return 0;
+
 	return fdt_setprop_inplace_u32(fdt, node, name, adj_val);
 }
 
@@ -143,6 +759,7 @@ static int overlay_phandle_add_offset(void *fdt, int node,
  * @fdto: Device tree overlay blob
  * @node: Offset of the node we want to adjust
  * @delta: Offset to shift the phandles of
+ * @dry: only check that the phandles can be shifted
  *
  * overlay_adjust_node_phandles() adds a constant to all the phandles
  * of a given node. This is mainly use as part of the overlay
@@ -154,21 +771,22 @@ static int overlay_phandle_add_offset(void *fdt, int node,
  *      Negative error code on failure
  */
 static int overlay_adjust_node_phandles(void *fdto, int node,
-					uint32_t delta)
+					uint32_t delta, bool dry)
 {
 	int child;
 	int ret;
 
-	ret = overlay_phandle_add_offset(fdto, node, "phandle", delta);
+	ret = overlay_phandle_add_offset(fdto, node, "phandle", delta, dry);
 	if (ret && ret != -FDT_ERR_NOTFOUND)
 		return ret;
 
-	ret = overlay_phandle_add_offset(fdto, node, "linux,phandle", delta);
+	ret = overlay_phandle_add_offset(fdto, node, "linux,phandle", delta,
+					 dry);
 	if (ret && ret != -FDT_ERR_NOTFOUND)
 		return ret;
 
 	fdt_for_each_subnode(child, fdto, node) {
-		ret = overlay_adjust_node_phandles(fdto, child, delta);
+		ret = overlay_adjust_node_phandles(fdto, child, delta, dry);
 		if (ret)
 			return ret;
 	}
@@ -180,6 +798,7 @@ static int overlay_adjust_node_phandles(void *fdto, int node,
  * overlay_adjust_local_phandles - Adjust the phandles of a whole overlay
  * @fdto: Device tree overlay blob
  * @delta: Offset to shift the phandles of
+ * @dry: only check that the phandles can be shifted
  *
  * overlay_adjust_local_phandles() adds a constant to all the
  * phandles of an overlay. This is mainly use as part of the overlay
@@ -190,12 +809,13 @@ static int overlay_adjust_node_phandles(void *fdto, int node,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_adjust_local_phandles(void *fdto, uint32_t delta)
+static int overlay_adjust_local_phandles(void *fdto, uint32_t delta,
+					 bool dry)
 {
 	/*
 	 * Start adjusting the phandles from the overlay root
 	 */
-	return overlay_adjust_node_phandles(fdto, 0, delta);
+	return overlay_adjust_node_phandles(fdto, 0, delta, dry);
 }
 
 /**
@@ -204,6 +824,7 @@ static int overlay_adjust_local_phandles(void *fdto, uint32_t delta)
  * @tree_node: Node offset of the node to operate on
  * @fixup_node: Node offset of the matching local fixups node
  * @delta: Offset to shift the phandles of
+ * @dry: only check the local fixups
  *
  * overlay_update_local_nodes_references() update the phandles
  * pointing to a node within the device tree overlay by adding a
@@ -220,7 +841,7 @@ static int overlay_adjust_local_phandles(void *fdto, uint32_t delta)
 static int overlay_update_local_node_references(void *fdto,
 						int tree_node,
 						int fixup_node,
-						uint32_t delta)
+						uint32_t delta, bool dry)
 {
 	int fixup_prop;
 	int fixup_child;
@@ -228,7 +849,7 @@ static int overlay_update_local_node_references(void *fdto,
 
 	fdt_for_each_property_offset(fixup_prop, fdto, fixup_node) {
 		const fdt32_t *fixup_val;
-		const char *tree_val;
+		char *tree_val;
 		const char *name;
 		int fixup_len;
 		int tree_len;
@@ -243,7 +864,7 @@ static int overlay_update_local_node_references(void *fdto,
 			return -FDT_ERR_BADOVERLAY;
 		fixup_len /= sizeof(uint32_t);
 
-		tree_val = fdt_getprop(fdto, tree_node, name, &tree_len);
+		tree_val = fdt_getprop_w(fdto, tree_node, name, &tree_len);
 		if (!tree_val) {
 			if (tree_len == -FDT_ERR_NOTFOUND)
 				return -FDT_ERR_BADOVERLAY;
@@ -251,6 +872,19 @@ static int overlay_update_local_node_references(void *fdto,
 			return tree_len;
 		}
 
+		/*
+		 * Check every cell lies within the property, then patch
+		 * them all through the value we already hold.
+		 */
+		for (i = 0; i < fixup_len; i++)
+			if (((uint32_t)tree_len < sizeof(fdt32_t))
+			    || (fdt32_to_cpu(fixup_val[i])
+				> (tree_len - sizeof(fdt32_t))))
+				return -FDT_ERR_BADOVERLAY;
+
+		if (dry)
+			continue;
+
 		for (i = 0; i < fixup_len; i++) {
 			fdt32_t adj_val;
 			uint32_t poffset;
@@ -267,19 +901,13 @@ static int overlay_update_local_node_references(void *fdto,
 
 			adj_val = cpu_to_fdt32(fdt32_to_cpu(adj_val) + delta);
 
-			ret = fdt_setprop_inplace_namelen_partial(fdto,
-								  tree_node,
-								  name,
-								  strlen(name),
-								  poffset,
-								  &adj_val,
-								  sizeof(adj_val));
-			if (ret == -FDT_ERR_NOSPACE)
-				return -FDT_ERR_BADOVERLAY;
-
-			if (ret)
-				return ret;
+			memcpy(tree_val + poffset, &adj_val, sizeof(adj_val));
 		}
+
+		if (fixup_len)
+			fdt_index_prop_changed_(fdto, tree_node, name,
+						strlen(name), tree_val,
+						tree_len);
 	}
 
 	fdt_for_each_subnode(fixup_child, fdto, fixup_node) {
@@ -297,7 +925,7 @@ static int overlay_update_local_node_references(void *fdto,
 		ret = overlay_update_local_node_references(fdto,
 							   tree_child,
 							   fixup_child,
-							   delta);
+							   delta, dry);
 		if (ret)
 			return ret;
 	}
@@ -309,6 +937,7 @@ static int overlay_update_local_node_references(void *fdto,
  * overlay_update_local_references - Adjust the overlay references
  * @fdto: Device tree overlay blob
  * @delta: Offset to shift the phandles of
+ * @dry: only check the local fixups
  *
  * overlay_update_local_references() update all the phandles pointing
  * to a node within the device tree overlay by adding a constant
@@ -322,7 +951,8 @@ static int overlay_update_local_node_references(void *fdto,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_update_local_references(void *fdto, uint32_t delta)
+static int overlay_update_local_references(void *fdto, uint32_t delta,
+					   bool dry)
 {
 	int fixups;
 
@@ -339,20 +969,19 @@ static int overlay_update_local_references(void *fdto, uint32_t delta)
 	 * Update our local references from the root of the tree
 	 */
 	return overlay_update_local_node_references(fdto, 0, fixups,
-						    delta);
+						    delta, dry);
 }
 
 /**
  * overlay_fixup_one_phandle - Set an overlay phandle to the base one
- * @fdt: Base Device Tree blob
  * @fdto: Device tree overlay blob
- * @symbols_off: Node offset of the symbols node in the base device tree
  * @path: Path to a node holding a phandle in the overlay
  * @path_len: number of path characters to consider
  * @name: Name of the property holding the phandle reference in the overlay
  * @name_len: number of name characters to consider
  * @poffset: Offset within the overlay property where the phandle is stored
- * @label: Label of the node referenced by the phandle
+ * @phandle: Phandle of the base node referenced
+ * @dry: only check that the phandle reference exists
  *
  * overlay_fixup_one_phandle() resolves an overlay phandle pointing to
  * a node in the base device tree.
@@ -365,40 +994,33 @@ static int overlay_update_local_references(void *fdto, uint32_t delta)
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_fixup_one_phandle(void *fdt, void *fdto,
-				     int symbols_off,
+static int overlay_fixup_one_phandle(void *fdto,
 				     const char *path, uint32_t path_len,
 				     const char *name, uint32_t name_len,
-				     int poffset, const char *label)
+				     int poffset, uint32_t phandle, bool dry)
 {
-	const char *symbol_path;
-	uint32_t phandle;
 	fdt32_t phandle_prop;
-	int symbol_off, fixup_off;
-	int prop_len;
-
-	if (symbols_off < 0)
-		return symbols_off;
-
-	symbol_path = fdt_getprop(fdt, symbols_off, label,
-				  &prop_len);
-	if (!symbol_path)
-		return prop_len;
-
-	symbol_off = fdt_path_offset(fdt, symbol_path);
-	if (symbol_off < 0)
-		return symbol_off;
-
-	phandle = fdt_get_phandle(fdt, symbol_off);
-	if (!phandle)
-		return -FDT_ERR_NOTFOUND;
+	int fixup_off;
 
+	/* Through the path cache of overlay_fixup_index(), if any */
 	fixup_off = fdt_path_offset_namelen(fdto, path, path_len);
 	if (fixup_off == -FDT_ERR_NOTFOUND)
 		return -FDT_ERR_BADOVERLAY;
 	if (fixup_off < 0)
 		return fixup_off;
 
+	if (dry) {
+		int len;
+
+		/* as fdt_setprop_inplace_namelen_partial() would check */
+		if (!fdt_getprop_namelen(fdto, fixup_off, name, name_len,
+					 &len))
+			return len;
+		if ((unsigned)len < (sizeof(phandle_prop) + poffset))
+			return -FDT_ERR_NOSPACE;
+		return 0;
+	}
+
 	phandle_prop = cpu_to_fdt32(phandle);
 	return fdt_setprop_inplace_namelen_partial(fdto, fixup_off,
 						   name, name_len, poffset,
@@ -408,7 +1030,7 @@ static int overlay_fixup_one_phandle(void *fdt, void *fdto,
 
 /**
  * overlay_fixup_phandle - Set an overlay phandle to the base one
- * @fdt: Base Device Tree blob
+ * @tree: Base device tree
  * @fdto: Device tree overlay blob
  * @symbols_off: Node offset of the symbols node in the base device tree
  * @property: Property offset in the overlay holding the list of fixups
@@ -425,11 +1047,12 @@ static int overlay_fixup_one_phandle(void *fdt, void *fdto,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_fixup_phandle(void *fdt, void *fdto, int symbols_off,
-				 int property)
+static int overlay_fixup_phandle(const struct overlay_tree *tree, void *fdto,
+				 int symbols_off, int property)
 {
 	const char *value;
 	const char *label;
+	uint32_t phandle = 0;
 	int len;
 
 	value = fdt_getprop_by_offset(fdto, property,
@@ -442,58 +1065,100 @@ static int overlay_fixup_phandle(void *fdt, void *fdto, int symbols_off,
 	}
 
 	do {
-		const char *path, *name, *fixup_end;
-		const char *fixup_str = value;
+		const char *path, *name;
 		uint32_t path_len, name_len;
-		uint32_t fixup_len;
-		char *sep, *endptr;
 		int poffset, ret;
 
-		fixup_end = memchr(value, '\0', len);
-		if (!fixup_end)
-			return -FDT_ERR_BADOVERLAY;
-		fixup_len = fixup_end - fixup_str;
+		ret = overlay_fixup_parse(&value, &len, &path, &path_len,
+					  &name, &name_len, &poffset);
+		if (ret)
+			return ret;
 
-		len -= fixup_len + 1;
-		value += fixup_len + 1;
+		/* The base doesn't change while fixing up, look it up once */
+		if (!phandle) {
+			ret = overlay_symbol_phandle(tree, symbols_off, label,
+						     &phandle);
+			if (ret && tree->check)
+				return overlay_report(tree,
+						      FDT_OVERLAY_UNRESOLVED,
+						      property, label, ret);
+			if (ret)
+				return ret;
+		}
 
-		path = fixup_str;
-		sep = memchr(fixup_str, ':', fixup_len);
-		if (!sep || *sep != ':')
-			return -FDT_ERR_BADOVERLAY;
+		ret = overlay_fixup_one_phandle(fdto, path, path_len,
+						name, name_len, poffset,
+						phandle, !!tree->check);
+		if (ret)
+			return ret;
+	} while (len > 0);
 
-		path_len = sep - path;
-		if (path_len == (fixup_len - 1))
-			return -FDT_ERR_BADOVERLAY;
+	return 0;
+}
 
-		fixup_len -= path_len + 1;
-		name = sep + 1;
-		sep = memchr(name, ':', fixup_len);
-		if (!sep || *sep != ':')
-			return -FDT_ERR_BADOVERLAY;
+/**
+ * overlay_fixup_index - Attach a path cache to the overlay for fixing up
+ * @tree: Base device tree
+ * @fdto: Device tree overlay blob
+ *
+ * overlay_fixup_index() builds a path cache over the overlay in the
+ * free part of the scratch memory the tree was given, if any, and
+ * attaches it, so that the node holding several references is only
+ * walked to once. Nothing is recorded or merged while fixing up, so
+ * that memory is not otherwise in use until the index is detached.
+ * Fixups write in place, so the cached offsets stay valid.
+ *
+ * returns:
+ *      the index to detach once fixed up
+ *      NULL, if the overlay already has an index, or none could be set up
+ */
+static struct fdt_index *overlay_fixup_index(const struct overlay_tree *tree,
+					     void *fdto)
+{
+	struct fdt_index *idx;
+	char *buf, *end;
+	int size;
+
+	if (fdt_index_get_(fdto))
+		return NULL;
+
+	if (tree->txn) {
+		buf = tree->txn->buf + tree->txn->top;
+		end = tree->txn->buf + tree->txn->bottom;
+	} else if (tree->changes) {
+		buf = tree->changes->buf;
+		end = buf + tree->changes->size - tree->changes->used;
+	} else if (tree->parallel) {
+		buf = tree->parallel->buf;
+		end = buf + tree->parallel->bufsize;
+	} else {
+		return NULL;
+	}
 
-		name_len = sep - name;
-		if (!name_len)
-			return -FDT_ERR_BADOVERLAY;
+	idx = (struct fdt_index *)FDT_ALIGN((uintptr_t)buf, sizeof(uint64_t));
+	buf = (char *)(idx + 1);
+	if (buf > end)
+		return NULL;
 
-		poffset = strtoul(sep + 1, &endptr, 10);
-		if ((*endptr != '\0') || (endptr <= (sep + 1)))
-			return -FDT_ERR_BADOVERLAY;
+	/*
+	 * Each node takes at least 12 bytes of the structure block, and
+	 * each cached path 48 bytes: there is no use for more.
+	 */
+	size = end - buf;
+	if (size > (4 * (int)fdt_size_dt_struct(fdto)))
+		size = 4 * fdt_size_dt_struct(fdto);
 
-		ret = overlay_fixup_one_phandle(fdt, fdto, symbols_off,
-						path, path_len, name, name_len,
-						poffset, label);
-		if (ret)
-			return ret;
-	} while (len > 0);
+	if (fdt_index_init(idx, fdto) || fdt_index_paths(idx, buf, size)
+	    || fdt_index_attach(idx))
+		return NULL;
 
-	return 0;
+	return idx;
 }
 
 /**
  * overlay_fixup_phandles - Resolve the overlay phandles to the base
  *                          device tree
- * @fdt: Base Device Tree blob
+ * @tree: Base device tree
  * @fdto: Device tree overlay blob
  *
  * overlay_fixup_phandles() resolves all the overlay phandles pointing
@@ -507,10 +1172,11 @@ static int overlay_fixup_phandle(void *fdt, void *fdto, int symbols_off,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_fixup_phandles(void *fdt, void *fdto)
+static int overlay_fixup_phandles(const struct overlay_tree *tree, void *fdto)
 {
+	struct fdt_index *idx;
 	int fixups_off, symbols_off;
-	int property;
+	int property, ret = 0;
 
 	/* We can have overlays without any fixups */
 	fixups_off = fdt_path_offset(fdto, "/__fixups__");
@@ -520,24 +1186,28 @@ static int overlay_fixup_phandles(void *fdt, void *fdto)
 		return fixups_off;
 
 	/* And base DTs without symbols */
-	symbols_off = fdt_path_offset(fdt, "/__symbols__");
+	symbols_off = overlay_path_offset(tree, "/__symbols__");
 	if ((symbols_off < 0 && (symbols_off != -FDT_ERR_NOTFOUND)))
 		return symbols_off;
 
-	fdt_for_each_property_offset(property, fdto, fixups_off) {
-		int ret;
+	idx = overlay_fixup_index(tree, fdto);
 
-		ret = overlay_fixup_phandle(fdt, fdto, symbols_off, property);
+	fdt_for_each_property_offset(property, fdto, fixups_off) {
+		ret = overlay_fixup_phandle(tree, fdto, symbols_off,
+					    property);
 		if (ret)
-			return ret;
+			break;
 	}
 
-	return 0;
+	if (idx)
+		fdt_index_detach(idx);
+
+	return ret;
 }
 
 /**
  * overlay_apply_node - Merges a node into the base device tree
- * @fdt: Base Device Tree blob
+ * @tree: Base device tree
  * @target: Node offset in the base device tree to apply the fragment to
  * @fdto: Device tree overlay blob
  * @node: Node offset in the overlay holding the changes to merge
@@ -554,15 +1224,17 @@ static int overlay_fixup_phandles(void *fdt, void *fdto)
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_apply_node(void *fdt, int target,
+static int overlay_apply_node(const struct overlay_tree *tree, int target,
 			      void *fdto, int node)
 {
+	int pathlen = -1;
 	int property;
 	int subnode;
 
 	fdt_for_each_property_offset(property, fdto, node) {
 		const char *name;
 		const void *prop;
+		fdt32_t adj_val;
 		int prop_len;
 		int ret;
 
@@ -573,27 +1245,47 @@ static int overlay_apply_node(void *fdt, int target,
 		if (prop_len < 0)
 			return prop_len;
 
-		ret = fdt_setprop(fdt, target, name, prop, prop_len);
+		ret = overlay_record_prop(tree, target, &pathlen, name);
+		if (ret)
+			return ret;
+
+		/* a dry run merges the phandles as they would be shifted */
+		if (tree->check && (prop_len == sizeof(fdt32_t))
+		    && fdt_index_is_phandle_name_(name, strlen(name))) {
+			adj_val = cpu_to_fdt32(fdt32_ld(prop)
+					       + tree->check->delta);
+			prop = &adj_val;
+		}
+
+		ret = overlay_setprop(tree, target, name, prop, prop_len);
 		if (ret)
 			return ret;
 	}
 
 	fdt_for_each_subnode(subnode, fdto, node) {
 		const char *name = fdt_get_name(fdto, subnode, NULL);
+		struct overlay_tree sub = *tree;
 		int nnode;
 		int ret;
 
-		nnode = fdt_add_subnode(fdt, target, name);
+		nnode = overlay_add_subnode(tree, target, name);
 		if (nnode == -FDT_ERR_EXISTS) {
-			nnode = fdt_subnode_offset(fdt, target, name);
+			nnode = overlay_subnode_offset(tree, target, name);
 			if (nnode == -FDT_ERR_NOTFOUND)
 				return -FDT_ERR_INTERNAL;
+		} else if (nnode >= 0) {
+			/* removing the node undoes all the edits below it */
+			ret = overlay_record(tree, OVERLAY_NODE_ADDED, nnode,
+					     NULL, NULL, NULL, 0);
+			if (ret)
+				return ret;
+			sub.changes = NULL;
 		}
 
 		if (nnode < 0)
 			return nnode;
 
-		ret = overlay_apply_node(fdt, nnode, fdto, subnode);
+		ret = overlay_apply_node(&sub, nnode, fdto, subnode);
 		if (ret)
 			return ret;
 	}
@@ -601,9 +1293,88 @@ static int overlay_apply_node(void *fdt, int target,
 	return 0;
 }
 
+/**
+ * overlay_merge_node - Merge an overlay node into a base tree node
+ * @tree: Base device tree
+ * @target: Node offset in the base device tree to apply the fragment to
+ * @fdto: Device tree overlay blob
+ * @node: Node offset in the overlay holding the changes to merge
+ *
+ * overlay_merge_node() behaves like overlay_apply_node(), but a blob
+ * edited in place takes the whole merged subtree in a single splice
+ * when it has spare room for a copy of it. Otherwise, and in a
+ * transaction, each property and subnode is applied in turn.
+ *
+ * returns:
+ *      0 on success
+ *      Negative error code on failure
+ */
+static int overlay_merge_node(const struct overlay_tree *tree, int target,
+			      void *fdto, int node)
+{
+	struct overlay_targets *targets = tree->targets;
+
+	if (!tree->txn && !tree->changes
+	    && !fdt_merge_node_(tree->fdt, target, fdto, node,
+				targets ? targets->target : NULL,
+				targets ? targets->count : 0))
+		return 0;
+
+	return overlay_apply_node(tree, target, fdto, node);
+}
+
+/**
+ * overlay_merge_parallel - Merge all the fragments of an overlay at once
+ * @tree: Base device tree
+ * @fdto: Device tree overlay blob
+ *
+ * overlay_merge_parallel() hands the fragments over to
+ * fdt_merge_nodes_() when each of their targets is found before
+ * anything is merged. Fragments whose targets lie within the same
+ * subtree are merged together, in order, by a single job.
+ *
+ * returns:
+ *      0 once merged
+ *      1, if the fragments have to be merged one after the other, with
+ *      the base device tree left as it was
+ */
+static int overlay_merge_parallel(const struct overlay_tree *tree,
+				  void *fdto)
+{
+	struct overlay_parallel *parallel = tree->parallel;
+	struct overlay_targets *targets = tree->targets;
+	int fragment, overlay, target, count = 0;
+
+	/* @buf could not spare the room to record every fragment */
+	if (!parallel->nodes)
+		return 1;
+
+	fdt_for_each_subnode(fragment, fdto, 0) {
+		overlay = fdt_subnode_offset(fdto, fragment, "__overlay__");
+		if (overlay == -FDT_ERR_NOTFOUND)
+			continue;
+		if (overlay < 0)
+			return 1;
+
+		target = overlay_target(tree, fdto, fragment, NULL);
+		if (target < 0)
+			return 1;
+
+		parallel->nodes[count++] = overlay;
+	}
+
+	/* the targets are recorded in the same order */
+	if (!count || (targets->count != count))
+		return 1;
+
+	return fdt_merge_nodes_(tree->fdt, targets->target, fdto,
+				parallel->nodes, count, parallel->buf,
+				parallel->bufsize, parallel->threads);
+}
+
 /**
  * overlay_merge - Merge an overlay into its base device tree
- * @fdt: Base Device Tree blob
+ * @tree: Base device tree
  * @fdto: Device tree overlay blob
  *
  * overlay_merge() merges an overlay into its base device tree.
@@ -616,10 +1387,14 @@ static int overlay_apply_node(void *fdt, int target,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_merge(void *fdt, void *fdto)
+static int overlay_merge(const struct overlay_tree *tree, void *fdto)
 {
 	int fragment;
 
+	if (tree->parallel && !tree->txn && !tree->changes
+	    && !overlay_merge_parallel(tree, fdto))
+		return 0;
+
 	fdt_for_each_subnode(fragment, fdto, 0) {
 		int overlay;
 		int target;
@@ -636,11 +1411,18 @@ static int overlay_merge(void *fdt, void *fdto)
 		if (overlay < 0)
 			return overlay;
 
-		target = overlay_get_target(fdt, fdto, fragment, NULL);
+		target = overlay_target(tree, fdto, fragment, NULL);
+		if ((target < 0) && tree->check) {
+			ret = overlay_report(tree, FDT_OVERLAY_NO_TARGET,
+					     fragment, NULL, target);
+			if (ret)
+				return ret;
+			continue;
+		}
 		if (target < 0)
 			return target;
 
-		ret = overlay_apply_node(fdt, target, fdto, overlay);
+		ret = overlay_merge_node(tree, target, fdto, overlay);
 		if (ret)
 			return ret;
 	}
@@ -648,15 +1430,13 @@ static int overlay_merge(void *fdt, void *fdto)
 	return 0;
 }
 
-static int get_path_len(const void *fdt, int nodeoffset)
+static int get_path_len(const struct overlay_tree *tree, int nodeoffset)
 {
 	int len = 0, namelen;
 	const char *name;
 
-	FDT_RO_PROBE(fdt);
-
 	for (;;) {
-		name = fdt_get_name(fdt, nodeoffset, &namelen);
+		name = overlay_get_name(tree, nodeoffset, &namelen);
 		if (!name)
 			return namelen;
 
@@ -664,7 +1444,7 @@ static int get_path_len(const void *fdt, int nodeoffset)
 		if (namelen == 0)
 			break;
 
-		nodeoffset = fdt_parent_offset(fdt, nodeoffset);
+		nodeoffset = overlay_parent_offset(tree, nodeoffset);
 		if (nodeoffset < 0)
 			return nodeoffset;
 		len += namelen + 1;
@@ -678,7 +1458,7 @@ static int get_path_len(const void *fdt, int nodeoffset)
 
 /**
  * overlay_symbol_update - Update the symbols of base tree after a merge
- * @fdt: Base Device Tree blob
+ * @tree: Base device tree
  * @fdto: Device tree overlay blob
  *
  * overlay_symbol_update() updates the symbols of the base tree with the
@@ -692,10 +1472,11 @@ static int get_path_len(const void *fdt, int nodeoffset)
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_symbol_update(void *fdt, void *fdto)
+static int overlay_symbol_update(const struct overlay_tree *tree, void *fdto)
 {
+	struct overlay_tree sym = *tree;
 	int root_sym, ov_sym, prop, path_len, fragment, target;
-	int len, frag_name_len, ret, rel_path_len;
+	int len, frag_name_len, ret, rel_path_len, root_pathlen = -1;
 	const char *s, *e;
 	const char *path;
 	const char *name;
@@ -711,11 +1492,20 @@ static int overlay_symbol_update(void *fdt, void *fdto)
 	if (ov_sym < 0)
 		return 0;
 
-	root_sym = fdt_subnode_offset(fdt, 0, "__symbols__");
+	root_sym = overlay_subnode_offset(tree, 0, "__symbols__");
 
 	/* it no root symbols exist we should create them */
-	if (root_sym == -FDT_ERR_NOTFOUND)
-		root_sym = fdt_add_subnode(fdt, 0, "__symbols__");
+	if (root_sym == -FDT_ERR_NOTFOUND) {
+		root_sym = overlay_add_subnode(tree, 0, "__symbols__");
+		if (root_sym >= 0) {
+			ret = overlay_record(tree, OVERLAY_NODE_ADDED,
+					     root_sym, NULL, NULL, NULL, 0);
+			if (ret)
+				return ret;
+			sym.changes = NULL;
+			tree = &sym;
+		}
+	}
 
 	/* any error is fatal now */
 	if (root_sym < 0)
@@ -778,15 +1568,17 @@ static int overlay_symbol_update(void *fdt, void *fdto)
 		if (ret < 0)
 			return -FDT_ERR_BADOVERLAY;
 
-		/* get the target of the fragment */
-		ret = overlay_get_target(fdt, fdto, fragment, &target_path);
+		/* get the target of the fragment, as recorded by the merge */
+		ret = overlay_target(tree, fdto, fragment, &target_path);
+		if ((ret < 0) && tree->check)
+			continue; /* already reported */
 		if (ret < 0)
 			return ret;
 		target = ret;
 
 		/* if we have a target path use */
 		if (!target_path) {
-			ret = get_path_len(fdt, target);
+			ret = get_path_len(tree, target);
 			if (ret < 0)
 				return ret;
 			len = ret;
@@ -794,14 +1586,19 @@ static int overlay_symbol_update(void *fdt, void *fdto)
 			len = strlen(target_path);
 		}
 
-		ret = fdt_setprop_placeholder(fdt, root_sym, name,
+		ret = overlay_record_prop(tree, root_sym, &root_pathlen,
+					  name);
+		if (ret)
+			return ret;
+
+		ret = overlay_setprop_placeholder(tree, root_sym, name,
 				len + (len > 1) + rel_path_len + 1, &p);
 		if (ret < 0)
 			return ret;
 
 		if (!target_path) {
-			/* again in case setprop_placeholder changed it */
-			ret = overlay_get_target(fdt, fdto, fragment, &target_path);
+			/* again in case setprop_placeholder moved it */
+			ret = overlay_target(tree, fdto, fragment, &target_path);
 			if (ret < 0)
 				return ret;
 			target = ret;
@@ -810,7 +1607,7 @@ static int overlay_symbol_update(void *fdt, void *fdto)
 		buf = p;
 		if (len > 1) { /* target is not root */
 			if (!target_path) {
-				ret = fdt_get_path(fdt, target, buf, len + 1);
+				ret = overlay_get_path(tree, target, buf, len + 1);
 				if (ret < 0)
 					return ret;
 			} else
@@ -827,46 +1624,140 @@ static int overlay_symbol_update(void *fdt, void *fdto)
 	return 0;
 }
 
-int fdt_overlay_apply(void *fdt, void *fdto)
+/**
+ * overlay_targets_init - Set up the record of the fragments' targets
+ * @tree: Base device tree, whose scratch memory is drawn from
+ * @fdto: Device tree overlay blob
+ * @targets: record to set up
+ * @view: changeset to make the edits through, see below
+ *
+ * overlay_targets_init() takes the arrays of @targets, with room for
+ * every fragment, from the memory @tree was given: for a transaction,
+ * from the transaction memory; for a changeset, from the start of its
+ * free part, with @view describing the rest and put in its place; and
+ * for a parallel merge, from the start of @buf, along with the array
+ * of __overlay__ nodes handed to fdt_merge_nodes_(). When there is no
+ * such memory or it is too small, the arrays are left as they are.
+ */
+static void overlay_targets_init(struct overlay_tree *tree,
+				 const void *fdto,
+				 struct overlay_targets *targets,
+				 struct fdt_changeset *view)
+{
+	struct overlay_parallel *parallel = tree->parallel;
+	char *buf, *end;
+	int fragment, count = 0, size;
+
+	/* an upper bound, the nodes which are no fragments included */
+	fdt_for_each_subnode(fragment, fdto, 0)
+		count++;
+
+	size = count * (sizeof(*targets->path) + 2 * sizeof(int));
+
+	if (tree->txn) {
+		if (count <= targets->max)
+			return;
+		buf = fdt_txn_reserve_(tree->txn, size);
+		if (!buf)
+			return;
+	} else if (tree->changes) {
+		if (count <= targets->max)
+			return;
+		*view = *tree->changes;
+		buf = (char *)FDT_ALIGN((uintptr_t)view->buf,
+					sizeof(uint64_t));
+		size = FDT_TAGALIGN(buf + size - view->buf);
+		if (size > (view->size - view->used))
+			return;
+		view->buf += size;
+		view->size -= size;
+		tree->changes = view;
+	} else if (parallel) {
+		buf = (char *)FDT_ALIGN((uintptr_t)parallel->buf,
+					sizeof(uint64_t));
+		end = (char *)parallel->buf + parallel->bufsize;
+		size += count * sizeof(int);
+		if (size > (end - buf))
+			return;
+		parallel->nodes = (int *)(buf + size) - count;
+		parallel->buf = buf + size;
+		parallel->bufsize = end - (buf + size);
+	} else {
+		return;
+	}
+
+	targets->path = (const char **)buf;
+	targets->fragment = (int *)(targets->path + count);
+	targets->target = targets->fragment + count;
+	targets->max = count;
+}
+
+/* The steps of overlay_apply(), once the targets can be recorded */
+static int overlay_apply_steps(const struct overlay_tree *tree, void *fdto)
 {
 	uint32_t delta;
 	int ret;
 
-	FDT_RO_PROBE(fdt);
-	FDT_RO_PROBE(fdto);
-
-	ret = fdt_find_max_phandle(fdt, &delta);
+	ret = overlay_find_max_phandle(tree, &delta);
 	if (ret)
-		goto err;
+		return ret;
 
-	ret = overlay_adjust_local_phandles(fdto, delta);
-	if (ret)
-		goto err;
+	if (tree->check)
+		tree->check->delta = delta;
 
-	ret = overlay_update_local_references(fdto, delta);
+	ret = overlay_adjust_local_phandles(fdto, delta, !!tree->check);
 	if (ret)
-		goto err;
+		return ret;
 
-	ret = overlay_fixup_phandles(fdt, fdto);
+	ret = overlay_update_local_references(fdto, delta, !!tree->check);
 	if (ret)
-		goto err;
+		return ret;
 
-	ret = overlay_merge(fdt, fdto);
+	ret = overlay_fixup_phandles(tree, fdto);
 	if (ret)
-		goto err;
+		return ret;
 
-	ret = overlay_symbol_update(fdt, fdto);
+	ret = overlay_merge(tree, fdto);
 	if (ret)
-		goto err;
+		return ret;
 
-	/*
-	 * The overlay has been damaged, erase its magic.
-	 */
-	fdt_set_magic(fdto, ~0);
+	return overlay_symbol_update(tree, fdto);
+}
 
-	return 0;
+static int overlay_apply(const struct overlay_tree *base, void *fdto)
+{
+	int fragment[OVERLAY_TARGETS], target[OVERLAY_TARGETS];
+	const char *path[OVERLAY_TARGETS];
+	struct overlay_targets targets = {
+		fragment, target, path, 0, OVERLAY_TARGETS
+	};
+	struct overlay_tree tree = *base;
+	struct fdt_changeset view;
+	int ret;
+
+	tree.targets = &targets;
+	overlay_targets_init(&tree, fdto, &targets, &view);
+
+	ret = overlay_apply_steps(&tree, fdto);
+
+	/* the records made through @view are the changeset's */
+	if (tree.changes != base->changes)
+		base->changes->used = view.used;
+
+	return ret;
+}
+
+/* Apply an overlay to a blob edited in place */
+static int overlay_apply_in_place(const struct overlay_tree *tree,
+				  void *fdto)
+{
+	int ret;
+
+	FDT_RO_PROBE(tree->fdt);
+	FDT_RO_PROBE(fdto);
+
+	ret = overlay_apply(tree, fdto);
 
-err:
 	/*
 	 * The overlay might have been damaged, erase its magic.
 	 */
@@ -876,7 +1767,341 @@ err:
 	 * The base device tree might have been damaged, erase its
 	 * magic.
 	 */
-	fdt_set_magic(fdt, ~0);
+	if (ret)
+		fdt_set_magic(tree->fdt, ~0);
 
 	return ret;
 }
+
+int fdt_overlay_apply(void *fdt, void *fdto)
+{
+	return fdt_overlay_apply_changeset(fdt, fdto, NULL);
+}
+
+int fdt_overlay_apply_parallel(void *fdt, void *fdto, void *buf,
+			       int bufsize, int threads)
+{
+	struct overlay_parallel parallel = { buf, bufsize, threads, NULL };
+	struct overlay_tree tree = {
+		fdt, NULL, NULL, NULL, NULL, NULL, &parallel
+	};
+
+	return overlay_apply_in_place(&tree, fdto);
+}
+
+int fdt_overlay_apply_txn(struct fdt_txn *txn, void *fdto)
+{
+	struct overlay_tree tree = { NULL, txn, NULL, NULL, NULL, NULL, NULL };
+	int ret;
+
+	FDT_RO_PROBE(fdto);
+
+	ret = overlay_apply(&tree, fdto);
+
+	/*
+	 * The overlay might have been damaged, erase its magic. The base
+	 * device tree is only read.
+	 */
+	fdt_set_magic(fdto, ~0);
+
+	return ret;
+}
+
+int fdt_overlay_apply_atomic(void *fdt, void *fdto, void *buf, int bufsize)
+{
+	struct fdt_txn txn;
+	int ret;
+
+	FDT_RO_PROBE(fdto);
+
+	ret = fdt_txn_init(&txn, fdt, buf, bufsize);
+	if (ret) {
+		fdt_set_magic(fdto, ~0);
+		return ret;
+	}
+
+	ret = fdt_overlay_apply_txn(&txn, fdto);
+	if (ret)
+		return ret;
+
+	/* Nothing is written to the base until the result is known to fit */
+	return fdt_txn_commit(&txn, fdt, fdt_totalsize(fdt));
+}
+
+int fdt_overlay_apply_size(const void *fdt, const void *fdto, void *buf,
+			   int bufsize)
+{
+	struct fdt_txn txn;
+	int size, ret;
+
+	FDT_RO_PROBE(fdto);
+
+	/* Resolving the phandles edits the overlay, so work on a copy */
+	size = FDT_TAGALIGN(fdt_totalsize(fdto));
+	if ((bufsize < 0) || (size > bufsize))
+		return -FDT_ERR_NOSPACE;
+
+	ret = fdt_move(fdto, buf, fdt_totalsize(fdto));
+	if (ret)
+		return ret;
+
+	ret = fdt_txn_init(&txn, fdt, (char *)buf + size, bufsize - size);
+	if (ret)
+		return ret;
+
+	ret = fdt_overlay_apply_txn(&txn, buf);
+	if (ret)
+		return ret;
+
+	return txn.peak;
+}
+
+int fdt_overlay_check(const void *fdt, const void *fdto, void *buf,
+		      int bufsize, struct fdt_overlay_report *report)
+{
+	struct overlay_check check = { report, 0, 0 };
+	struct overlay_tree tree = {
+		NULL, NULL, NULL, NULL, NULL, &check, NULL
+	};
+	struct fdt_txn txn;
+	int ret;
+
+	FDT_RO_PROBE(fdto);
+
+	report->unresolved = 0;
+	report->missing = 0;
+	report->overwritten = 0;
+
+	ret = fdt_txn_init(&txn, fdt, buf, bufsize);
+	if (ret)
+		return ret;
+
+	/* On a dry run the overlay is only read */
+	tree.txn = &txn;
+	ret = overlay_apply(&tree, (void *)(uintptr_t)fdto);
+	if (ret)
+		return ret;
+
+	report->delta = txn.size - (int)fdt_data_size_(fdt);
+	report->size = txn.peak;
+
+	return check.error;
+}
+
+int fdt_overlay_apply_many(void *fdt, void **fdtos, int count, void *buf,
+			   int bufsize)
+{
+	struct overlay_tree tree = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+	struct fdt_txn txn;
+	uint32_t base_max;
+	int i, ret;
+
+	ret = fdt_txn_init(&txn, fdt, buf, bufsize);
+	if (ret)
+		return ret;
+
+	/*
+	 * The base is only read, so its highest phandle is found once;
+	 * each overlay's phandles then start past those of the base and
+	 * of the overlays before it.
+	 */
+	ret = fdt_find_max_phandle(fdt, &base_max);
+	if (ret)
+		return ret;
+
+	tree.txn = &txn;
+	tree.base_max = &base_max;
+
+	for (i = 0; i < count; i++) {
+		FDT_RO_PROBE(fdtos[i]);
+
+		ret = overlay_apply(&tree, fdtos[i]);
+		fdt_set_magic(fdtos[i], ~0);
+		if (ret)
+			return ret;
+	}
+
+	return fdt_txn_commit(&txn, fdt, fdt_totalsize(fdt));
+}
+
+int fdt_changeset_init(struct fdt_changeset *cs, void *buf, int bufsize)
+{
+	if ((uintptr_t)buf & (sizeof(fdt32_t) - 1))
+		return -FDT_ERR_ALIGNMENT;
+	if (bufsize < 0)
+		return -FDT_ERR_NOSPACE;
+
+	cs->buf = buf;
+	cs->size = bufsize & ~(FDT_TAGSIZE - 1);
+	cs->used = 0;
+	return 0;
+}
+
+int fdt_overlay_apply_changeset(void *fdt, void *fdto,
+				struct fdt_changeset *cs)
+{
+	struct overlay_tree tree = { fdt, NULL, NULL, NULL, cs, NULL, NULL };
+
+	return overlay_apply_in_place(&tree, fdto);
+}
+
+int fdt_overlay_revert(void *fdt, const struct fdt_changeset *cs, void *buf,
+		       int bufsize)
+{
+	const struct overlay_change *rec;
+	const char *path, *name;
+	struct fdt_txn txn;
+	int pos, size, pathlen, namelen, len, node;
+	int ret;
+
+	ret = fdt_txn_init(&txn, fdt, buf, bufsize);
+	if (ret)
+		return ret;
+
+	/* the newest edit comes first, so each one is undone in order */
+	for (pos = cs->size - cs->used; pos < cs->size; pos += size) {
+		if ((cs->size - pos) < (int)sizeof(*rec))
+			return -FDT_ERR_TRUNCATED;
+
+		rec = (const struct overlay_change *)(cs->buf + pos);
+		pathlen = fdt32_to_cpu(rec->pathlen);
+		namelen = fdt32_to_cpu(rec->namelen);
+		len = fdt32_to_cpu(rec->len);
+		if ((pathlen < 0) || (namelen < 0) || (len < 0)
+		    || (pathlen > cs->size) || (namelen > cs->size)
+		    || (len > cs->size))
+			return -FDT_ERR_TRUNCATED;
+
+		size = sizeof(*rec) + FDT_TAGALIGN(pathlen + namelen + 2 + len);
+		if ((cs->size - pos) < size)
+			return -FDT_ERR_TRUNCATED;
+
+		path = (const char *)(rec + 1);
+		name = path + pathlen + 1;
+		if (name[namelen] != '\0')
+			return -FDT_ERR_TRUNCATED;
+
+		node = fdt_txn_path_offset_namelen(&txn, path, pathlen);
+		if (node < 0)
+			return node;
+
+		switch (fdt32_to_cpu(rec->type)) {
+		case OVERLAY_PROP_ADDED:
+			ret = fdt_txn_delprop(&txn, node, name);
+			break;
+		case OVERLAY_PROP_CHANGED:
+			ret = fdt_txn_setprop(&txn, node, name,
+					      name + namelen + 1, len);
+			break;
+		case OVERLAY_NODE_ADDED:
+			ret = fdt_txn_del_node(&txn, node);
+			break;
+		default:
+			return -FDT_ERR_BADVALUE;
+		}
+		if (ret)
+			return ret;
+	}
+
+	return fdt_txn_commit(&txn, fdt, fdt_totalsize(fdt));
+}
+
+/*
+ * A compiled overlay holds the fingerprints of the base and of the
+ * overlay it was compiled from, followed by the script replaying the
+ * application on that base. The script has a fingerprint of its own,
+ * so that a damaged one is not played.
+ */
+#define OVERLAY_COMPILED_MAGIC	0x6f766c63	/* "ovlc" */
+
+struct overlay_compiled {
+	fdt32_t magic;
+	fdt32_t base[2];
+	fdt32_t overlay[2];
+	fdt32_t size;		/* of the script */
+	fdt32_t script[2];
+};
+
+static void overlay_fingerprint_set(fdt32_t *p, uint64_t h)
+{
+	p[0] = cpu_to_fdt32(h >> 32);
+	p[1] = cpu_to_fdt32(h);
+}
+
+static bool overlay_fingerprint_eq(const fdt32_t *p, uint64_t h)
+{
+	return (fdt32_to_cpu(p[0]) == (uint32_t)(h >> 32))
+		&& (fdt32_to_cpu(p[1]) == (uint32_t)h);
+}
+
+int fdt_overlay_compile(struct fdt_txn *txn, void *fdto, void *buf,
+			int bufsize)
+{
+	struct overlay_compiled *c = buf;
+	uint64_t overlay;
+	int ret;
+
+	FDT_RO_PROBE(fdto);
+
+	/* Taken before resolving the phandles edits the overlay */
+	overlay = fdt_fingerprint_(fdto);
+
+	ret = fdt_overlay_apply_txn(txn, fdto);
+	if (ret)
+		return ret;
+
+	if ((uintptr_t)buf & (FDT_TAGSIZE - 1))
+		return -FDT_ERR_ALIGNMENT;
+	if ((bufsize < 0) || ((unsigned int)bufsize < sizeof(*c)))
+		return -FDT_ERR_NOSPACE;
+
+	ret = fdt_txn_script_(txn, c + 1, bufsize - sizeof(*c));
+	if (ret < 0)
+		return ret;
+
+	c->magic = cpu_to_fdt32(OVERLAY_COMPILED_MAGIC);
+	overlay_fingerprint_set(c->base, fdt_fingerprint_(txn->fdt));
+	overlay_fingerprint_set(c->overlay, overlay);
+	c->size = cpu_to_fdt32(ret);
+	overlay_fingerprint_set(c->script, fdt_fingerprint_buf_(c + 1, ret));
+
+	return sizeof(*c) + ret;
+}
+
+int fdt_overlay_apply_compiled(void *fdt, void *fdto, const void *buf,
+			       int len)
+{
+	const struct overlay_compiled *c = buf;
+	uint32_t size;
+	int ret;
+
+	FDT_RO_PROBE(fdt);
+	FDT_RO_PROBE(fdto);
+
+	if (((uintptr_t)buf & (FDT_TAGSIZE - 1))
+	    || (len < (int)sizeof(*c))
+	    || (fdt32_to_cpu(c->magic) != OVERLAY_COMPILED_MAGIC))
+		goto fallback;
+
+	size = fdt32_to_cpu(c->size);
+	if ((size > (len - sizeof(*c)))
+	    || !overlay_fingerprint_eq(c->script,
+				       fdt_fingerprint_buf_(c + 1, size))
+	    || !overlay_fingerprint_eq(c->base, fdt_fingerprint_(fdt))
+	    || !overlay_fingerprint_eq(c->overlay, fdt_fingerprint_(fdto)))
+		goto fallback;
+
+	/*
+	 * Nothing is looked up: the script only moves parts of the base
+	 * and copies in new bytes. Its fingerprint, its pieces and the
+	 * header it writes are all checked before the base is written,
+	 * so a damaged one is simply not used.
+	 */
+	ret = fdt_txn_script_play_(fdt, c + 1, size);
+	if ((ret == 0) || (ret == -FDT_ERR_NOSPACE))
+		return ret;
+
+fallback:
+	ret = fdt_overlay_apply(fdt, fdto);
+	return ret ? ret : 1;
+}
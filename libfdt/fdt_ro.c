@@ -10,8 +10,7 @@
 
 #include "libfdt_internal.h"
 
-static int fdt_nodename_eq_(const void *fdt, int offset,
-			    const char *s, int len)
+int fdt_nodename_eq_(const void *fdt, int offset, const char *s, int len)
 {
 	int olen;
 	const char *p = fdt_get_name(fdt, offset, &olen);
@@ -111,11 +110,154 @@ static int fdt_string_eq_(const void *fdt, int stroffset,
 	return p && (slen == len) && (memcmp(p, s, len) == 0);
 }
 
+/*
+ * First and last places where the @len bytes at @s, followed by a NUL,
+ * occur in the strings block. A name can occur more than once, for
+ * instance as the tail of a longer one.
+ */
+static int fdt_intern_(const void *fdt, const char *s, int len, int *last)
+{
+	const char *strtab = (const char *)fdt + fdt_off_dt_strings(fdt);
+	const char *end = strtab + fdt_size_dt_strings(fdt);
+	const char *z;
+	int first = -FDT_ERR_NOTFOUND;
+
+	for (z = strtab + len; (z < end) && (z = memchr(z, '\0', end - z));
+	     z++)
+		if (memcmp(z - len, s, len) == 0) {
+			if (first < 0)
+				first = z - len - strtab;
+			*last = z - len - strtab;
+		}
+
+	return first;
+}
+
+int fdt_intern_namelen(const void *fdt, const char *name, int namelen)
+{
+	struct fdt_index *idx;
+	int offset, last, err;
+
+	FDT_RO_PROBE(fdt);
+	if (fdt_magic(fdt) != FDT_MAGIC)
+		return -FDT_ERR_BADSTATE;
+
+	/* The strings table also knows the first place a name occurs */
+	idx = fdt_index_get_(fdt);
+	if (idx) {
+		err = fdt_index_string_find_(idx, name, namelen + 1, &offset);
+		if (err != -FDT_ERR_BADSTATE)
+			return err ? err : offset;
+	}
+
+	return fdt_intern_(fdt, name, namelen, &last);
+}
+
+int fdt_intern(const void *fdt, const char *name)
+{
+	return fdt_intern_namelen(fdt, name, strlen(name));
+}
+
+/*
+ * Where the two names of a phandle property lie in the strings block,
+ * looked up once for a whole pass over the tree.
+ */
+struct fdt_phandle_names_ {
+	int first[2];
+	int last[2];
+};
+
+static const char *const fdt_phandle_name_[] = { "phandle", "linux,phandle" };
+
+/* NULL if fdt_get_phandle() has to do, as the blob is too old or unfinished */
+static const struct fdt_phandle_names_ *
+fdt_intern_phandle_names_(const void *fdt, struct fdt_phandle_names_ *n)
+{
+	int i;
+
+	if ((fdt_magic(fdt) != FDT_MAGIC)
+	    || (!can_assume(LATEST) && (fdt_version(fdt) < 0x10)))
+		return NULL;
+
+	for (i = 0; i < 2; i++)
+		n->first[i] = fdt_intern_(fdt, fdt_phandle_name_[i],
+					  strlen(fdt_phandle_name_[i]),
+					  &n->last[i]);
+	return n;
+}
+
+/*
+ * Whether @nameoff is phandle name @i. libfdt and dtc always refer to
+ * the first place a name occurs, so the strings only need comparing
+ * for other copies of it, which can lie no further than the last.
+ */
+static bool fdt_is_phandle_name_(const void *fdt,
+				 const struct fdt_phandle_names_ *n,
+				 int nameoff, int i)
+{
+	if (nameoff == n->first[i])
+		return true;
+	if ((n->first[i] < 0) || (nameoff < n->first[i])
+	    || (nameoff > n->last[i]))
+		return false;
+
+	return fdt_string_eq_(fdt, nameoff, fdt_phandle_name_[i],
+			      strlen(fdt_phandle_name_[i]));
+}
+
+/*
+ * As fdt_get_phandle(), comparing names by their offset, and finding
+ * both properties in one pass over those of the node.
+ */
+static uint32_t fdt_get_phandle_(const void *fdt, int nodeoffset,
+				 const struct fdt_phandle_names_ *n)
+{
+	const struct fdt_property *php = NULL, *lphp = NULL;
+	int offset;
+
+	if (!n)
+		return fdt_get_phandle(fdt, nodeoffset);
+
+	fdt_for_each_property_offset(offset, fdt, nodeoffset) {
+		const struct fdt_property *prop;
+		int nameoff;
+
+		prop = fdt_get_property_by_offset(fdt, offset, NULL);
+		if (!prop)
+			break;
+
+		nameoff = fdt32_ld_(&prop->nameoff);
+		if (!php && fdt_is_phandle_name_(fdt, n, nameoff, 0)) {
+			php = prop;
+			if (fdt32_ld_(&prop->len) == sizeof(fdt32_t))
+				break;
+		} else if (!lphp && fdt_is_phandle_name_(fdt, n, nameoff, 1)) {
+			lphp = prop;
+		}
+	}
+
+	if (php && (fdt32_ld_(&php->len) == sizeof(fdt32_t)))
+		return fdt32_ld_((const fdt32_t *)php->data);
+	if (lphp && (fdt32_ld_(&lphp->len) == sizeof(fdt32_t)))
+		return fdt32_ld_((const fdt32_t *)lphp->data);
+
+	return 0;
+}
+
 int fdt_find_max_phandle(const void *fdt, uint32_t *phandle)
 {
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	const struct fdt_phandle_names_ *names;
+	struct fdt_phandle_names_ n;
 	uint32_t max = 0;
 	int offset = -1;
 
+	if (idx && (fdt_index_max_phandle_(idx, &max) == 0))
+		goto out;
+
+	FDT_RO_PROBE(fdt);
+	names = fdt_intern_phandle_names_(fdt, &n);
+
 	while (true) {
 		uint32_t value;
 
@@ -127,12 +269,16 @@ int fdt_find_max_phandle(const void *fdt, uint32_t *phandle)
 			return offset;
 		}
 
-		value = fdt_get_phandle(fdt, offset);
+		value = fdt_get_phandle_(fdt, offset, names);
 
 		if (value > max)
 			max = value;
 	}
 
+	if (idx)
+		fdt_index_max_phandle_set_(idx, max);
+
+out:
 	if (phandle)
 		*phandle = max;
 
@@ -225,10 +371,24 @@ static int nextprop_(const void *fdt, int offset)
 int fdt_subnode_offset_namelen(const void *fdt, int offset,
 			       const char *name, int namelen)
 {
-	int depth;
+	struct fdt_index *idx;
+	int depth, parent, i;
 
 	FDT_RO_PROBE(fdt);
 
+	/* With a node table, step over each child's subtree in one go */
+	idx = fdt_index_get_(fdt);
+	if (idx && ((parent = fdt_index_node_find_(idx, offset)) >= 0)) {
+		for (i = parent + 1;
+		     (i < idx->node_count) && (idx->nodes[i].parent == parent);
+		     i = fdt_index_node_next_(idx, i))
+			if (fdt_nodename_eq_(fdt, idx->nodes[i].offset,
+					     name, namelen))
+				return idx->nodes[i].offset;
+
+		return -FDT_ERR_NOTFOUND;
+	}
+
 	for (depth = 0;
 	     (offset >= 0) && (depth >= 0);
 	     offset = fdt_next_node(fdt, offset, &depth))
@@ -247,14 +407,13 @@ int fdt_subnode_offset(const void *fdt, int parentoffset,
 	return fdt_subnode_offset_namelen(fdt, parentoffset, name, strlen(name));
 }
 
-int fdt_path_offset_namelen(const void *fdt, const char *path, int namelen)
+static int fdt_path_offset_namelen_(const void *fdt, const char *path,
+				    int namelen)
 {
 	const char *end = path + namelen;
 	const char *p = path;
 	int offset = 0;
 
-	FDT_RO_PROBE(fdt);
-
 	/* see if we have an alias */
 	if (*path != '/') {
 		const char *q = memchr(path, '/', end - p);
@@ -292,6 +451,28 @@ int fdt_path_offset_namelen(const void *fdt, const char *path, int namelen)
 	return offset;
 }
 
+int fdt_path_offset_namelen(const void *fdt, const char *path, int namelen)
+{
+	struct fdt_index *idx;
+	int offset;
+
+	FDT_RO_PROBE(fdt);
+
+	idx = fdt_index_get_(fdt);
+	if (!idx || (*path != '/'))
+		return fdt_path_offset_namelen_(fdt, path, namelen);
+
+	offset = fdt_index_path_offset_(idx, path, namelen);
+	if (offset >= 0)
+		return offset;
+
+	offset = fdt_path_offset_namelen_(fdt, path, namelen);
+	if (offset >= 0)
+		fdt_index_path_add_(idx, path, namelen, offset);
+
+	return offset;
+}
+
 int fdt_path_offset(const void *fdt, const char *path)
 {
 	return fdt_path_offset_namelen(fdt, path, strlen(path));
@@ -398,6 +579,28 @@ static const struct fdt_property *fdt_get_property_namelen_(const void *fdt,
 							    int *lenp,
 							    int *poffset)
 {
+	struct fdt_index *idx = fdt_index_get_(fdt);
+
+	if (idx) {
+		int propoffset = fdt_index_symbol_find_(idx, offset, name,
+							namelen);
+
+		if (propoffset == -FDT_ERR_BADSTATE)
+			propoffset = fdt_index_prop_find_(idx, offset, name,
+							  namelen);
+
+		if (propoffset >= 0) {
+			if (poffset)
+				*poffset = propoffset;
+			return fdt_get_property_by_offset_(fdt, propoffset,
+							   lenp);
+		} else if (propoffset != -FDT_ERR_BADSTATE) {
+			if (lenp)
+				*lenp = propoffset;
+			return NULL;
+		}
+	}
+
 	for (offset = fdt_first_property_offset(fdt, offset);
 	     (offset >= 0);
 	     (offset = fdt_next_property_offset(fdt, offset))) {
@@ -466,6 +669,44 @@ const void *fdt_getprop_namelen(const void *fdt, int nodeoffset,
 	return prop->data;
 }
 
+const struct fdt_property *fdt_get_property_by_nameoff(const void *fdt,
+						      int nodeoffset,
+						      int nameoff, int *lenp)
+{
+	const struct fdt_property *prop;
+	int offset;
+
+	/* As fdt_get_property_namelen(), for version 16 and later only */
+	if (!can_assume(LATEST) && fdt_version(fdt) < 0x10) {
+		if (lenp)
+			*lenp = -FDT_ERR_BADVERSION;
+		return NULL;
+	}
+
+	fdt_for_each_property_offset(offset, fdt, nodeoffset) {
+		prop = fdt_get_property_by_offset_(fdt, offset, lenp);
+		if (!can_assume(LIBFDT_FLAWLESS) && !prop) {
+			offset = -FDT_ERR_INTERNAL;
+			break;
+		}
+		if (fdt32_ld_(&prop->nameoff) == (uint32_t)nameoff)
+			return prop;
+	}
+
+	if (lenp)
+		*lenp = offset;
+	return NULL;
+}
+
+const void *fdt_getprop_by_nameoff(const void *fdt, int nodeoffset,
+				   int nameoff, int *lenp)
+{
+	const struct fdt_property *prop;
+
+	prop = fdt_get_property_by_nameoff(fdt, nodeoffset, nameoff, lenp);
+	return prop ? prop->data : NULL;
+}
+
 const void *fdt_getprop_by_offset(const void *fdt, int offset,
 				  const char **namep, int *lenp)
 {
@@ -544,12 +785,20 @@ int fdt_get_path(const void *fdt, int nodeoffset, char *buf, int buflen)
 	int pdepth = 0, p = 0;
 	int offset, depth, namelen;
 	const char *name;
+	struct fdt_index *idx;
 
 	FDT_RO_PROBE(fdt);
 
 	if (buflen < 2)
 		return -FDT_ERR_NOSPACE;
 
+	idx = fdt_index_get_(fdt);
+	if (idx) {
+		offset = fdt_index_get_path_(idx, nodeoffset, buf, buflen);
+		if (offset != -FDT_ERR_BADSTATE)
+			return offset;
+	}
+
 	for (offset = 0, depth = 0;
 	     (offset >= 0) && (offset <= nodeoffset);
 	     offset = fdt_next_node(fdt, offset, &depth)) {
@@ -596,12 +845,30 @@ int fdt_supernode_atdepth_offset(const void *fdt, int nodeoffset,
 {
 	int offset, depth;
 	int supernodeoffset = -FDT_ERR_INTERNAL;
+	struct fdt_index *idx;
 
 	FDT_RO_PROBE(fdt);
 
 	if (supernodedepth < 0)
 		return -FDT_ERR_NOTFOUND;
 
+	/* With a node table, climb the parent links instead of rescanning */
+	idx = fdt_index_get_(fdt);
+	if (idx && ((offset = fdt_index_node_find_(idx, nodeoffset)) >= 0)) {
+		const struct fdt_index_node *nodes = idx->nodes;
+
+		if (nodedepth)
+			*nodedepth = nodes[offset].depth;
+
+		if (supernodedepth > nodes[offset].depth)
+			return -FDT_ERR_NOTFOUND;
+
+		while (nodes[offset].depth > supernodedepth)
+			offset = nodes[offset].parent;
+
+		return nodes[offset].offset;
+	}
+
 	for (offset = 0, depth = 0;
 	     (offset >= 0) && (offset <= nodeoffset);
 	     offset = fdt_next_node(fdt, offset, &depth)) {
@@ -643,7 +910,15 @@ int fdt_node_depth(const void *fdt, int nodeoffset)
 
 int fdt_parent_offset(const void *fdt, int nodeoffset)
 {
-	int nodedepth = fdt_node_depth(fdt, nodeoffset);
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int nodedepth, i;
+
+	if (idx && ((i = fdt_index_node_find_(idx, nodeoffset)) >= 0)) {
+		i = idx->nodes[i].parent;
+		return (i < 0) ? -FDT_ERR_NOTFOUND : idx->nodes[i].offset;
+	}
+
+	nodedepth = fdt_node_depth(fdt, nodeoffset);
 
 	if (nodedepth < 0)
 		return nodedepth;
@@ -655,12 +930,23 @@ int fdt_node_offset_by_prop_value(const void *fdt, int startoffset,
 				  const char *propname,
 				  const void *propval, int proplen)
 {
+	struct fdt_index *idx;
 	int offset;
 	const void *val;
 	int len;
 
 	FDT_RO_PROBE(fdt);
 
+	/* The scan reports a bad start the way fdt_next_node() does */
+	idx = fdt_index_get_(fdt);
+	if (idx && ((startoffset < 0)
+		    || (fdt_check_node_offset_(fdt, startoffset) >= 0))) {
+		offset = fdt_index_prop_value_next_(idx, startoffset, propname,
+						    propval, proplen);
+		if (offset != -FDT_ERR_BADSTATE)
+			return offset;
+	}
+
 	/* FIXME: The algorithm here is pretty horrible: we scan each
 	 * property of a node in fdt_getprop(), then if that didn't
 	 * find what we want, we scan over them again making our way
@@ -678,8 +964,30 @@ int fdt_node_offset_by_prop_value(const void *fdt, int startoffset,
 	return offset; /* error from fdt_next_node() */
 }
 
+int fdt_node_offsets_by_prop_value(const void *fdt, const char *propname,
+				   const void *propval, int proplen,
+				   int *offsets, int count)
+{
+	int offset, n = 0;
+
+	for (offset = fdt_node_offset_by_prop_value(fdt, -1, propname,
+						    propval, proplen);
+	     offset >= 0;
+	     offset = fdt_node_offset_by_prop_value(fdt, offset, propname,
+						    propval, proplen)) {
+		if (n < count)
+			offsets[n] = offset;
+		n++;
+	}
+
+	return (offset == -FDT_ERR_NOTFOUND) ? n : offset;
+}
+
 int fdt_node_offset_by_phandle(const void *fdt, uint32_t phandle)
 {
+	const struct fdt_phandle_names_ *names;
+	struct fdt_phandle_names_ n;
+	struct fdt_index *idx;
 	int offset;
 
 	if ((phandle == 0) || (phandle == ~0U))
@@ -687,17 +995,30 @@ int fdt_node_offset_by_phandle(const void *fdt, uint32_t phandle)
 
 	FDT_RO_PROBE(fdt);
 
+	idx = fdt_index_get_(fdt);
+	if (idx) {
+		offset = fdt_index_phandle_offset_(idx, phandle);
+		if (offset != -FDT_ERR_BADSTATE)
+			return offset;
+	}
+
 	/* FIXME: The algorithm here is pretty horrible: we
 	 * potentially scan each property of a node in
 	 * fdt_get_phandle(), then if that didn't find what
 	 * we want, we scan over them again making our way to the next
 	 * node.  Still it's the easiest to implement approach;
-	 * performance can come later. */
+	 * performance can come later. Attaching an index with a
+	 * phandle table (see fdt_index_phandles()) avoids it; without
+	 * one, property names are at least compared as offsets. */
+	names = fdt_intern_phandle_names_(fdt, &n);
 	for (offset = fdt_next_node(fdt, -1, NULL);
 	     offset >= 0;
 	     offset = fdt_next_node(fdt, offset, NULL)) {
-		if (fdt_get_phandle(fdt, offset) == phandle)
+		if (fdt_get_phandle_(fdt, offset, names) == phandle) {
+			if (idx)
+				fdt_index_phandle_add_(idx, phandle, offset);
 			return offset;
+		}
 	}
 
 	return offset; /* error from fdt_next_node() */
@@ -836,10 +1157,21 @@ int fdt_node_check_compatible(const void *fdt, int nodeoffset,
 int fdt_node_offset_by_compatible(const void *fdt, int startoffset,
 				  const char *compatible)
 {
+	struct fdt_index *idx;
 	int offset, err;
 
 	FDT_RO_PROBE(fdt);
 
+	/* The scan reports a bad start the way fdt_next_node() does */
+	idx = fdt_index_get_(fdt);
+	if (idx && ((startoffset < 0)
+		    || (fdt_check_node_offset_(fdt, startoffset) >= 0))) {
+		offset = fdt_index_compatible_next_(idx, startoffset,
+						    compatible);
+		if (offset != -FDT_ERR_BADSTATE)
+			return offset;
+	}
+
 	/* FIXME: The algorithm here is pretty horrible: we scan each
 	 * property of a node in fdt_node_check_compatible(), then if
 	 * that didn't find what we want, we scan over them again
@@ -10,8 +10,13 @@
 
 #include "libfdt_internal.h"
 
-static int fdt_blocks_misordered_(const void *fdt,
-				  int mem_rsv_size, int struct_size)
+#ifdef FDT_THREADS
+#include <pthread.h>
+
+#define FDT_MERGE_THREADS	16
+#endif
+
+int fdt_blocks_misordered_(const void *fdt, int mem_rsv_size, int struct_size)
 {
 	return (fdt_off_mem_rsvmap(fdt) < FDT_ALIGN(sizeof(struct fdt_header), 8))
 		|| (fdt_off_dt_struct(fdt) <
@@ -46,11 +51,6 @@ static int fdt_rw_probe_(void *fdt)
 			return err_; \
 	}
 
-static inline unsigned int fdt_data_size_(void *fdt)
-{
-	return fdt_off_dt_strings(fdt) + fdt_size_dt_strings(fdt);
-}
-
 static int fdt_splice_(void *fdt, void *splicepoint, int oldlen, int newlen)
 {
 	char *p = splicepoint;
@@ -84,6 +84,7 @@ static int fdt_splice_struct_(void *fdt, void *p,
 			      int oldlen, int newlen)
 {
 	int delta = newlen - oldlen;
+	int offset = (char *)p - ((char *)fdt + fdt_off_dt_struct(fdt));
 	int err;
 
 	if ((err = fdt_splice_(fdt, p, oldlen, newlen)))
@@ -91,6 +92,9 @@ static int fdt_splice_struct_(void *fdt, void *p,
 
 	fdt_set_size_dt_struct(fdt, fdt_size_dt_struct(fdt) + delta);
 	fdt_set_off_dt_strings(fdt, fdt_off_dt_strings(fdt) + delta);
+
+	/* Keep offsets recorded in an attached index valid */
+	fdt_index_splice_(fdt, offset, oldlen, newlen);
 	return 0;
 }
 
@@ -100,6 +104,7 @@ static void fdt_del_last_string_(void *fdt, const char *s)
 	int newlen = strlen(s) + 1;
 
 	fdt_set_size_dt_strings(fdt, fdt_size_dt_strings(fdt) - newlen);
+	fdt_index_strings_trimmed_(fdt);
 }
 
 static int fdt_splice_string_(void *fdt, int newlen)
@@ -127,18 +132,28 @@ static int fdt_splice_string_(void *fdt, int newlen)
 static int fdt_find_add_string_(void *fdt, const char *s, int *allocated)
 {
 	char *strtab = (char *)fdt + fdt_off_dt_strings(fdt);
+	struct fdt_index *idx = fdt_index_get_(fdt);
 	const char *p;
 	char *new;
 	int len = strlen(s) + 1;
-	int err;
+	int offset, err;
 
 	if (!can_assume(NO_ROLLBACK))
 		*allocated = 0;
 
-	p = fdt_find_string_(strtab, fdt_size_dt_strings(fdt), s);
-	if (p)
+	err = idx ? fdt_index_string_find_(idx, s, len, &offset)
+		: -FDT_ERR_BADSTATE;
+	if (!err)
 		/* found it */
-		return (p - strtab);
+		return offset;
+
+	/* No usable strings table, scan the block */
+	if (err == -FDT_ERR_BADSTATE) {
+		p = fdt_find_string_(strtab, fdt_size_dt_strings(fdt), s);
+		if (p)
+			/* found it */
+			return (p - strtab);
+	}
 
 	new = strtab + fdt_size_dt_strings(fdt);
 	err = fdt_splice_string_(fdt, len);
@@ -149,6 +164,7 @@ static int fdt_find_add_string_(void *fdt, const char *s, int *allocated)
 		*allocated = 1;
 
 	memcpy(new, s, len);
+	fdt_index_string_added_(fdt, new - strtab, len);
 	return (new - strtab);
 }
 
@@ -196,6 +212,8 @@ static int fdt_resize_property_(void *fdt, int nodeoffset, const char *name,
 		return err;
 
 	(*prop)->len = cpu_to_fdt32(len);
+	/* Clear the padding, rather than leave whatever the splice moved */
+	memset((*prop)->data + len, 0, FDT_TAGALIGN(len) - len);
 	return 0;
 }
 
@@ -229,6 +247,7 @@ static int fdt_add_property_(void *fdt, int nodeoffset, const char *name,
 	(*prop)->tag = cpu_to_fdt32(FDT_PROP);
 	(*prop)->nameoff = cpu_to_fdt32(namestroff);
 	(*prop)->len = cpu_to_fdt32(len);
+	memset((*prop)->data + len, 0, FDT_TAGALIGN(len) - len);
 	return 0;
 }
 
@@ -252,11 +271,13 @@ int fdt_set_name(void *fdt, int nodeoffset, const char *name)
 		return err;
 
 	memcpy(namep, name, newlen+1);
+	fdt_index_node_renamed_(fdt, nodeoffset);
 	return 0;
 }
 
-int fdt_setprop_placeholder(void *fdt, int nodeoffset, const char *name,
-			    int len, void **prop_data)
+static int fdt_setprop_placeholder_(void *fdt, int nodeoffset,
+				    const char *name, int len,
+				    void **prop_data)
 {
 	struct fdt_property *prop;
 	int err;
@@ -273,18 +294,35 @@ int fdt_setprop_placeholder(void *fdt, int nodeoffset, const char *name,
 	return 0;
 }
 
+int fdt_setprop_placeholder(void *fdt, int nodeoffset, const char *name,
+			    int len, void **prop_data)
+{
+	int err;
+
+	err = fdt_setprop_placeholder_(fdt, nodeoffset, name, len, prop_data);
+	if (err)
+		return err;
+
+	/* The value is yet to be written by the caller */
+	fdt_index_prop_changed_(fdt, nodeoffset, name, strlen(name), NULL, len);
+	return 0;
+}
+
 int fdt_setprop(void *fdt, int nodeoffset, const char *name,
 		const void *val, int len)
 {
 	void *prop_data;
 	int err;
 
-	err = fdt_setprop_placeholder(fdt, nodeoffset, name, len, &prop_data);
+	err = fdt_setprop_placeholder_(fdt, nodeoffset, name, len, &prop_data);
 	if (err)
 		return err;
 
 	if (len)
 		memcpy(prop_data, val, len);
+
+	fdt_index_prop_changed_(fdt, nodeoffset, name, strlen(name),
+				prop_data, len);
 	return 0;
 }
 
@@ -312,13 +350,16 @@ int fdt_appendprop(void *fdt, int nodeoffset, const char *name,
 			return err;
 		memcpy(prop->data, val, len);
 	}
+
+	fdt_index_prop_changed_(fdt, nodeoffset, name, strlen(name),
+				prop->data, fdt32_to_cpu(prop->len));
 	return 0;
 }
 
 int fdt_delprop(void *fdt, int nodeoffset, const char *name)
 {
 	struct fdt_property *prop;
-	int len, proplen;
+	int len, proplen, err;
 
 	FDT_RW_PROBE(fdt);
 
@@ -327,7 +368,12 @@ int fdt_delprop(void *fdt, int nodeoffset, const char *name)
 		return len;
 
 	proplen = sizeof(*prop) + FDT_TAGALIGN(len);
-	return fdt_splice_struct_(fdt, prop, proplen, 0);
+	err = fdt_splice_struct_(fdt, prop, proplen, 0);
+	if (err)
+		return err;
+
+	fdt_index_prop_changed_(fdt, nodeoffset, name, strlen(name), NULL, -1);
+	return 0;
 }
 
 int fdt_add_subnode_namelen(void *fdt, int parentoffset,
@@ -371,6 +417,7 @@ int fdt_add_subnode_namelen(void *fdt, int parentoffset,
 	endtag = (fdt32_t *)((char *)nh + nodelen - FDT_TAGSIZE);
 	*endtag = cpu_to_fdt32(FDT_END_NODE);
 
+	fdt_index_node_added_(fdt, parentoffset, offset, nodelen);
 	return offset;
 }
 
@@ -393,6 +440,841 @@ int fdt_del_node(void *fdt, int nodeoffset)
 				  endoffset - nodeoffset, 0);
 }
 
+/*
+ * Merging an overlay node into a node of the tree in one go, with the
+ * same result as fdt_setprop() on each of its properties followed by
+ * fdt_add_subnode() and a merge of each of its subnodes: new properties
+ * end up first in the node, the last one set first, and new subnodes
+ * right after the properties, the last one added first.
+ */
+struct fdt_merge_ {
+	void *fdt;
+	const void *fdto;
+	char *out;	/* the merged node is written here first */
+	int base;	/* offset of the merged node */
+	int *offsets;	/* node offsets to carry over to the merged tree */
+	int count;
+};
+
+/* Is @prop the first property of @node named like a previous one? */
+static int fdt_merge_prop_dup_(const void *fdto, int node, int prop,
+			       const char *name)
+{
+	const char *other;
+	int i;
+
+	fdt_for_each_property_offset(i, fdto, node) {
+		if (i == prop)
+			break;
+		if (fdt_getprop_by_offset(fdto, i, &other, NULL)
+		    && (strcmp(other, name) == 0))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Could subnodes named @a and @b name the same node? fdt_subnode_offset()
+ * finds either by the name of the other when both names are the same,
+ * or when one is the other without its unit address.
+ */
+static int fdt_merge_names_clash_(const char *a, int alen, const char *b,
+				  int blen)
+{
+	const char *at = memchr(a, '@', alen);
+	const char *bt = memchr(b, '@', blen);
+	int len = at ? at - a : alen;
+
+	if ((len != (bt ? bt - b : blen)) || (memcmp(a, b, len) != 0))
+		return 0;
+
+	return !at || !bt || ((alen == blen) && (memcmp(at, bt, alen - len)
+						 == 0));
+}
+
+/* Hash of a node name up to its unit address */
+static uint32_t fdt_merge_name_hash_(const char *name, int len)
+{
+	uint32_t h = 0;
+	int i;
+
+	for (i = 0; (i < len) && (name[i] != '@'); i++)
+		h = h * 31 + (unsigned char)name[i];
+
+	return h ^ (h >> 16);
+}
+
+/*
+ * Could two subnodes of the same node, in the subtree of @node of
+ * @fdto, name the same node? The subnodes of each node are hashed by
+ * their name up to the unit address into the free space of @fdt, so
+ * that only those sharing it are compared; without the room for that,
+ * each is compared with the ones before it.
+ */
+static int fdt_merge_dups_(void *fdt, const void *fdto, int node)
+{
+	int data = FDT_TAGALIGN(fdt_data_size_(fdt));
+	int *slots = (int *)((char *)fdt + data);
+	const char *name, *other;
+	int count = 0, nslots, sub, i, h, len, olen;
+
+	fdt_for_each_subnode(sub, fdto, node)
+		count++;
+
+	for (nslots = 2; nslots < (2 * count); nslots *= 2)
+		;
+
+	if ((count > 1) && ((unsigned)data + nslots * sizeof(int)
+			    <= fdt_totalsize(fdt))) {
+		for (h = 0; h < nslots; h++)
+			slots[h] = -1;
+
+		fdt_for_each_subnode(sub, fdto, node) {
+			name = fdt_get_name(fdto, sub, &len);
+			if (!name)
+				return 1;
+
+			h = fdt_merge_name_hash_(name, len) & (nslots - 1);
+			for (; slots[h] >= 0; h = (h + 1) & (nslots - 1)) {
+				other = fdt_get_name(fdto, slots[h], &olen);
+				if (fdt_merge_names_clash_(name, len, other,
+							   olen))
+					return 1;
+			}
+			slots[h] = sub;
+		}
+	} else if (count > 1) {
+		fdt_for_each_subnode(sub, fdto, node) {
+			name = fdt_get_name(fdto, sub, &len);
+			if (!name)
+				return 1;
+
+			fdt_for_each_subnode(i, fdto, node) {
+				if (i == sub)
+					break;
+				other = fdt_get_name(fdto, i, &olen);
+				if (fdt_merge_names_clash_(name, len, other,
+							   olen))
+					return 1;
+			}
+		}
+	}
+
+	fdt_for_each_subnode(sub, fdto, node)
+		if (fdt_merge_dups_(fdt, fdto, sub))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Work out by how much merging @node of @fdto into @nodeoffset grows
+ * it, or the size of the new node if @nodeoffset is negative, adding
+ * the names of new properties to the strings block if @add, in the
+ * order fdt_setprop() would. Returns 1 when the overlay has to be
+ * merged property by property, be it for an error or for properties
+ * which only make sense in that order; fdt_merge_dups_() has looked
+ * for such subnodes already.
+ */
+static int fdt_merge_size_(void *fdt, int nodeoffset, const void *fdto,
+			   int node, int add, int *sizep, uint32_t *phandlep)
+{
+	const char *name;
+	int size, prop, sub, namelen, len, oldlen, subsize, allocated, err;
+
+	if (nodeoffset < 0) {
+		if (!fdt_get_name(fdto, node, &namelen))
+			return 1;
+		size = 2 * FDT_TAGSIZE + FDT_TAGALIGN(namelen + 1);
+	} else {
+		size = 0;
+	}
+
+	fdt_for_each_property_offset(prop, fdto, node) {
+		const void *val = fdt_getprop_by_offset(fdto, prop, &name,
+							&len);
+
+		if (!val || fdt_merge_prop_dup_(fdto, node, prop, name))
+			return 1;
+
+		if ((nodeoffset >= 0)
+		    && fdt_get_property(fdt, nodeoffset, name, &oldlen)) {
+			size += FDT_TAGALIGN(len) - FDT_TAGALIGN(oldlen);
+		} else if ((nodeoffset >= 0)
+			   && (oldlen != -FDT_ERR_NOTFOUND)) {
+			return 1;
+		} else {
+			if (add) {
+				err = fdt_find_add_string_(fdt, name,
+							   &allocated);
+				if (err < 0)
+					return 1;
+			}
+			size += sizeof(struct fdt_property) + FDT_TAGALIGN(len);
+		}
+
+		if (phandlep && (len == sizeof(fdt32_t))
+		    && fdt_index_is_phandle_name_(name, strlen(name))
+		    && (fdt32_ld(val) > *phandlep))
+			*phandlep = fdt32_ld(val);
+	}
+	if (prop != -FDT_ERR_NOTFOUND)
+		return 1;
+
+	fdt_for_each_subnode(sub, fdto, node) {
+		int child = -FDT_ERR_NOTFOUND;
+
+		name = fdt_get_name(fdto, sub, &namelen);
+		if (!name)
+			return 1;
+
+		if (nodeoffset >= 0) {
+			child = fdt_subnode_offset_namelen(fdt, nodeoffset,
+							   name, namelen);
+			if ((child < 0) && (child != -FDT_ERR_NOTFOUND))
+				return 1;
+		}
+
+		err = fdt_merge_size_(fdt, child, fdto, sub, add, &subsize,
+				      phandlep);
+		if (err)
+			return err;
+		size += subsize;
+	}
+	if (sub != -FDT_ERR_NOTFOUND)
+		return 1;
+
+	*sizep = size;
+	return 0;
+}
+
+/* Copy the structure block from @offset to @end to @pos of the output */
+static void fdt_merge_copy_(struct fdt_merge_ *m, int offset, int end,
+			    int pos)
+{
+	int i, from;
+
+	memcpy(m->out + pos, fdt_offset_ptr_(m->fdt, offset), end - offset);
+
+	for (i = 0; i < m->count; i++) {
+		/* See fdt_merge_node_() */
+		from = -2 - m->offsets[i];
+		if ((from >= offset) && (from < end))
+			m->offsets[i] = m->base + pos + (from - offset);
+	}
+}
+
+/* The subnode of @node merged into @child of @nodeoffset, if any */
+static int fdt_merge_subnode_(struct fdt_merge_ *m, int nodeoffset,
+			      int node, int child)
+{
+	const char *name;
+	int sub, namelen;
+
+	fdt_for_each_subnode(sub, m->fdto, node) {
+		name = fdt_get_name(m->fdto, sub, &namelen);
+		if (fdt_nodename_eq_(m->fdt, child, name, namelen)
+		    && (fdt_subnode_offset_namelen(m->fdt, nodeoffset, name,
+						   namelen) == child))
+			return sub;
+	}
+
+	return -FDT_ERR_NOTFOUND;
+}
+
+/*
+ * Write @node of @fdto merged into @nodeoffset, or as a new node if
+ * @nodeoffset is negative, at @pos of the output. fdt_merge_size_()
+ * has checked both already. Returns the position past the node.
+ */
+static int fdt_merge_write_(struct fdt_merge_ *m, int nodeoffset, int node,
+			    int pos)
+{
+	const void *fdto = m->fdto;
+	struct fdt_property *prop;
+	const char *name;
+	const void *val;
+	int offset, nextoffset, i, len, allocated, size, next, child;
+	uint32_t tag;
+
+	if (nodeoffset >= 0) {
+		offset = fdt_check_node_offset_(m->fdt, nodeoffset);
+		fdt_merge_copy_(m, nodeoffset, offset, pos);
+		pos += offset - nodeoffset;
+	} else {
+		struct fdt_node_header *nh = (void *)(m->out + pos);
+
+		name = fdt_get_name(fdto, node, &len);
+		nh->tag = cpu_to_fdt32(FDT_BEGIN_NODE);
+		memset(nh->name, 0, FDT_TAGALIGN(len + 1));
+		memcpy(nh->name, name, len);
+		pos += FDT_TAGSIZE + FDT_TAGALIGN(len + 1);
+	}
+
+	/* New properties, written backwards from the end of their room */
+	size = 0;
+	fdt_for_each_property_offset(i, fdto, node) {
+		fdt_getprop_by_offset(fdto, i, &name, &len);
+		if ((nodeoffset < 0)
+		    || !fdt_get_property(m->fdt, nodeoffset, name, NULL))
+			size += sizeof(*prop) + FDT_TAGALIGN(len);
+	}
+	next = pos + size;
+	fdt_for_each_property_offset(i, fdto, node) {
+		val = fdt_getprop_by_offset(fdto, i, &name, &len);
+		if ((nodeoffset >= 0)
+		    && fdt_get_property(m->fdt, nodeoffset, name, NULL))
+			continue;
+
+		next -= sizeof(*prop) + FDT_TAGALIGN(len);
+		prop = (void *)(m->out + next);
+		prop->tag = cpu_to_fdt32(FDT_PROP);
+		prop->nameoff = cpu_to_fdt32(fdt_find_add_string_(m->fdt,
+								  name,
+								  &allocated));
+		prop->len = cpu_to_fdt32(len);
+		memcpy(prop->data, val, len);
+		memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
+	}
+	pos += size;
+
+	/* The properties of the node, the first of each name set anew */
+	if (nodeoffset >= 0) {
+		for (;; offset = nextoffset) {
+			tag = fdt_next_tag(m->fdt, offset, &nextoffset);
+			if (tag == FDT_NOP) {
+				fdt_merge_copy_(m, offset, nextoffset, pos);
+				pos += nextoffset - offset;
+				continue;
+			}
+			if (tag != FDT_PROP)
+				break;
+
+			name = fdt_get_string(m->fdt,
+				fdt32_ld_(&((const struct fdt_property *)
+					    fdt_offset_ptr_(m->fdt,
+							    offset))->nameoff),
+				NULL);
+			val = NULL;
+			fdt_for_each_property_offset(i, fdto, node) {
+				const char *s;
+
+				val = fdt_getprop_by_offset(fdto, i, &s, &len);
+				if (strcmp(s, name) == 0)
+					break;
+			}
+			if ((i < 0) || (fdt_get_property(m->fdt, nodeoffset,
+							 name, NULL)
+					!= fdt_offset_ptr_(m->fdt, offset))) {
+				fdt_merge_copy_(m, offset, nextoffset, pos);
+				pos += nextoffset - offset;
+				continue;
+			}
+
+			prop = (void *)(m->out + pos);
+			memcpy(prop, fdt_offset_ptr_(m->fdt, offset),
+			       sizeof(*prop));
+			prop->len = cpu_to_fdt32(len);
+			memcpy(prop->data, val, len);
+			memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
+			pos += sizeof(*prop) + FDT_TAGALIGN(len);
+		}
+	}
+
+	/* New subnodes, written backwards from the end of their room */
+	size = 0;
+	fdt_for_each_subnode(i, fdto, node) {
+		name = fdt_get_name(fdto, i, &len);
+		if ((nodeoffset < 0)
+		    || (fdt_subnode_offset_namelen(m->fdt, nodeoffset, name,
+						   len) < 0)) {
+			fdt_merge_size_(m->fdt, -1, fdto, i, 0, &len, NULL);
+			size += len;
+		}
+	}
+	next = pos + size;
+	fdt_for_each_subnode(i, fdto, node) {
+		name = fdt_get_name(fdto, i, &len);
+		if ((nodeoffset >= 0)
+		    && (fdt_subnode_offset_namelen(m->fdt, nodeoffset, name,
+						   len) >= 0))
+			continue;
+
+		fdt_merge_size_(m->fdt, -1, fdto, i, 0, &len, NULL);
+		next -= len;
+		fdt_merge_write_(m, -1, i, next);
+	}
+	pos += size;
+
+	if (nodeoffset < 0) {
+		*(fdt32_t *)(m->out + pos) = cpu_to_fdt32(FDT_END_NODE);
+		return pos + FDT_TAGSIZE;
+	}
+
+	/* The subnodes of the node, merged or copied, and its end */
+	for (;; offset = nextoffset) {
+		tag = fdt_next_tag(m->fdt, offset, &nextoffset);
+		if (tag != FDT_BEGIN_NODE) {
+			fdt_merge_copy_(m, offset, nextoffset, pos);
+			pos += nextoffset - offset;
+			if (tag == FDT_END_NODE)
+				return pos;
+			continue;
+		}
+
+		nextoffset = fdt_node_end_offset_(m->fdt, offset);
+		child = fdt_merge_subnode_(m, nodeoffset, node, offset);
+		if (child >= 0) {
+			pos = fdt_merge_write_(m, offset, child, pos);
+		} else {
+			fdt_merge_copy_(m, offset, nextoffset, pos);
+			pos += nextoffset - offset;
+		}
+	}
+}
+
+/*
+ * Merge @node of @fdto into @nodeoffset with a single splice of the
+ * structure block, carrying the @count node offsets at @offsets over
+ * to the merged tree. The merged node is first written past the end
+ * of the data, so this needs spare room for a copy of it.
+ *
+ * Returns 0 once merged, or 1 when the overlay node has to be merged
+ * property by property instead: the tree is then as fdt_setprop()
+ * and fdt_add_subnode() expect it, with at most some of the names of
+ * the new properties already added to the strings block, in the order
+ * they would add them.
+ */
+int fdt_merge_node_(void *fdt, int nodeoffset, const void *fdto, int node,
+		    int *offsets, int count)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	struct fdt_merge_ m;
+	uint32_t max, phandle = 0;
+	int end, oldlen, size, out, known, i;
+
+	if (fdt_rw_probe_(fdt))
+		return 1;
+
+	end = fdt_node_end_offset_(fdt, nodeoffset);
+	if ((end < 0) || fdt_check_node_offset_(fdt, nodeoffset) < 0)
+		return 1;
+	oldlen = end - nodeoffset;
+
+	if (fdt_merge_dups_(fdt, fdto, node)
+	    || fdt_merge_size_(fdt, nodeoffset, fdto, node, 1, &size,
+			       &phandle))
+		return 1;
+
+	out = FDT_TAGALIGN(fdt_data_size_(fdt) + (size > 0 ? size : 0));
+	if ((out < 0) || ((unsigned)out + oldlen + size > fdt_totalsize(fdt)))
+		return 1;
+
+	/*
+	 * Offsets within the node are only known once the merged node is
+	 * written; until then they hold -2 - their old value.
+	 */
+	for (i = 0; i < count; i++)
+		if (offsets[i] >= end)
+			offsets[i] += size;
+		else if (offsets[i] >= nodeoffset)
+			offsets[i] = -2 - offsets[i];
+
+	m.fdt = fdt;
+	m.fdto = fdto;
+	m.out = (char *)fdt + out;
+	m.base = nodeoffset;
+	m.offsets = offsets;
+	m.count = count;
+	fdt_merge_write_(&m, nodeoffset, node, 0);
+
+	known = idx && !fdt_index_max_phandle_(idx, &max);
+
+	/* There is room for it, so neither of these can fail */
+	fdt_splice_struct_(fdt, fdt_offset_ptr_w_(fdt, nodeoffset), oldlen,
+			   oldlen + size);
+	memcpy(fdt_offset_ptr_w_(fdt, nodeoffset), m.out, oldlen + size);
+
+	/* Too much moved to follow, start the index over */
+	fdt_index_rebuild_(fdt);
+	if (known)
+		fdt_index_max_phandle_set_(idx, (phandle > max) ? phandle : max);
+
+	return 0;
+}
+
+/*
+ * One of the targets merged by fdt_merge_nodes_(), along with the
+ * untouched part of the structure block just before it. Overlay nodes
+ * whose targets lie within the same subtree make up a single job:
+ * they are merged one after the other into a copy of that subtree,
+ * set up as a blob of its own at @sub, before the merged targets are
+ * laid out.
+ */
+struct fdt_merge_job_ {
+	struct fdt_merge_ m;
+	int index;	/* in the arrays given to fdt_merge_nodes_() */
+	int nodeoffset;	/* of the target, the outermost one of a group */
+	int end;	/* offset past the target's subtree */
+	int node;	/* overlay node merged into the target */
+	int size;	/* by how much the target grows */
+	int gap;	/* offset of the untouched part before the target */
+	int pos;	/* of the target in the merged structure block */
+	char *sub;	/* the subtree merged beforehand, NULL for one node */
+	const int *nodes;	/* overlay nodes of a group, in order */
+	int *offsets;	/* their targets, within the copy at @sub */
+	int count;	/* of nodes in the group */
+	int err;
+};
+
+/*
+ * Run a job: merge the nodes of a group into the copy of their subtree
+ * if @group, or put the target in its place in the merged structure
+ * block otherwise.
+ */
+static void fdt_merge_run_(struct fdt_merge_job_ *job, int group)
+{
+	int len = job->nodeoffset - job->gap;
+	int i;
+
+	if (group) {
+		for (i = 0; job->sub && !job->err && (i < job->count); i++)
+			job->err = fdt_merge_node_(job->sub, job->offsets[i],
+						   job->m.fdto, job->nodes[i],
+						   job->offsets, job->count);
+		return;
+	}
+
+	memcpy(job->m.out + job->pos - len,
+	       fdt_offset_ptr_(job->m.fdt, job->gap), len);
+	if (job->sub)
+		memcpy(job->m.out + job->pos, fdt_offset_ptr_(job->sub, 0),
+		       job->end - job->nodeoffset + job->size);
+	else
+		fdt_merge_write_(&job->m, job->nodeoffset, job->node,
+				 job->pos);
+}
+
+#ifdef FDT_THREADS
+struct fdt_merge_worker_ {
+	pthread_t thread;
+	struct fdt_merge_job_ *jobs;
+	int count;
+	int first;
+	int step;
+	int group;
+};
+
+static void *fdt_merge_worker_(void *arg)
+{
+	struct fdt_merge_worker_ *w = arg;
+	int i;
+
+	for (i = w->first; i < w->count; i += w->step)
+		fdt_merge_run_(&w->jobs[i], w->group);
+
+	return NULL;
+}
+#endif
+
+/* Run the jobs, spread over up to @threads threads if built for it */
+static void fdt_merge_run_all_(struct fdt_merge_job_ *jobs, int count,
+			       int threads, int group)
+{
+	int i;
+#ifdef FDT_THREADS
+	struct fdt_merge_worker_ workers[FDT_MERGE_THREADS];
+	int started;
+
+	if (threads > FDT_MERGE_THREADS)
+		threads = FDT_MERGE_THREADS;
+	if (threads > count)
+		threads = count;
+	if (threads < 1)
+		threads = 1;
+
+	/* This thread takes the first share */
+	for (started = 1; started < threads; started++) {
+		workers[started].jobs = jobs;
+		workers[started].count = count;
+		workers[started].first = started;
+		workers[started].step = threads;
+		workers[started].group = group;
+		if (pthread_create(&workers[started].thread, NULL,
+				   fdt_merge_worker_, &workers[started]))
+			break;
+	}
+
+	/* Whatever could not be handed to a thread is run here */
+	for (i = 0; i < count; i++)
+		if ((i % threads == 0) || (i % threads >= started))
+			fdt_merge_run_(&jobs[i], group);
+
+	for (i = 1; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+#else
+	(void)threads;
+	for (i = 0; i < count; i++)
+		fdt_merge_run_(&jobs[i], group);
+#endif
+}
+
+/*
+ * Copy the subtree of @job to a blob of its own at @sub, with the
+ * strings block of @fdt and room for @bound more bytes of structure
+ * as fdt_merge_node_() needs it. Returns the size of the blob.
+ */
+static int fdt_merge_sub_(const void *fdt, struct fdt_merge_job_ *job,
+			  char *sub, int bound)
+{
+	int len = job->end - job->nodeoffset;
+	int off_struct = FDT_ALIGN(sizeof(struct fdt_header), 8)
+		+ sizeof(struct fdt_reserve_entry);
+	int off_strings = off_struct + len + FDT_TAGSIZE;
+	int data = off_strings + fdt_size_dt_strings(fdt);
+	int total = FDT_ALIGN(data + 3 * (len + bound), 8);
+
+	if (sub) {
+		memset(sub, 0, off_struct);
+		fdt_set_magic(sub, FDT_MAGIC);
+		fdt_set_totalsize(sub, total);
+		fdt_set_off_dt_struct(sub, off_struct);
+		fdt_set_off_dt_strings(sub, off_strings);
+		fdt_set_off_mem_rsvmap(sub,
+				       FDT_ALIGN(sizeof(struct fdt_header), 8));
+		fdt_set_version(sub, 17);
+		fdt_set_last_comp_version(sub, 16);
+		fdt_set_size_dt_strings(sub, fdt_size_dt_strings(fdt));
+		fdt_set_size_dt_struct(sub, len + FDT_TAGSIZE);
+
+		memcpy(sub + off_struct, fdt_offset_ptr_(fdt, job->nodeoffset),
+		       len);
+		fdt32_st(sub + off_struct + len, FDT_END);
+		memcpy(sub + off_strings,
+		       (const char *)fdt + fdt_off_dt_strings(fdt),
+		       fdt_size_dt_strings(fdt));
+	}
+
+	return total;
+}
+
+/*
+ * Merge each of the @count @nodes of @fdto into the node at the same
+ * index of @targets, with the same result as fdt_merge_node_() would
+ * have merging them one after the other. Targets lying within the
+ * subtree of another one are merged by the same job, in order, and
+ * the other subtrees by a job each, all of which may run at once; the
+ * structure block is then replaced with a single splice. @targets
+ * receives the merged targets' offsets.
+ *
+ * Returns 0 once merged, or 1 when fdt_merge_node_() has to merge the
+ * nodes one at a time instead, with the tree left as it was.
+ */
+int fdt_merge_nodes_(void *fdt, int *targets, const void *fdto,
+		     const int *nodes, int count, void *buf, int bufsize,
+		     int threads)
+{
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	struct fdt_merge_job_ *jobs, *job;
+	uint32_t max, phandle = 0;
+	int strsize, structsize, newsize, grown, size, out, i, j, k, known;
+	int njobs, groups, bound, *order, *gnodes, *offsets;
+	char *newstruct, *sub;
+
+	if (fdt_rw_probe_(fdt) || (count <= 0) || (bufsize < 0))
+		return 1;
+
+	jobs = (void *)FDT_ALIGN((uintptr_t)buf, sizeof(uint64_t));
+	order = (int *)(jobs + count);
+	gnodes = order + count;
+	offsets = gnodes + count;
+	sub = (char *)FDT_ALIGN((uintptr_t)(offsets + count),
+				sizeof(uint64_t));
+	structsize = fdt_size_dt_struct(fdt);
+	if (sub > (char *)buf + bufsize)
+		return 1;
+
+	/* Sort the nodes by the offset of their target */
+	for (i = 0; i < count; i++) {
+		if (fdt_check_node_offset_(fdt, targets[i]) < 0)
+			return 1;
+		for (j = i; (j > 0) && (targets[order[j - 1]] > targets[i]);
+		     j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	/* A target within the subtree of the one before joins its job */
+	njobs = groups = 0;
+	for (k = 0; k < count; k++) {
+		i = order[k];
+		if (njobs && (targets[i] < jobs[njobs - 1].end)) {
+			job = &jobs[njobs - 1];
+			if (fdt_node_end_offset_(fdt, targets[i]) > job->end)
+				return 1;
+			groups += (job->count++ == 1);
+			continue;
+		}
+
+		job = &jobs[njobs++];
+		memset(job, 0, sizeof(*job));
+		job->nodeoffset = targets[i];
+		job->end = fdt_node_end_offset_(fdt, targets[i]);
+		if (job->end < 0)
+			return 1;
+		job->count = 1;
+		job->nodes = gnodes + k;
+		job->offsets = offsets + k;
+	}
+
+	/* The nodes of a job are merged in the order they are given in */
+	for (j = 0, k = 0; j < njobs; k += jobs[j++].count) {
+		job = &jobs[j];
+		for (i = 1; i < job->count; i++) {
+			int n = order[k + i], m;
+
+			for (m = i; (m > 0) && (order[k + m - 1] > n); m--)
+				order[k + m] = order[k + m - 1];
+			order[k + m] = n;
+		}
+		for (i = 0; i < job->count; i++) {
+			gnodes[k + i] = nodes[order[k + i]];
+			offsets[k + i] = targets[order[k + i]]
+				- job->nodeoffset;
+		}
+		job->index = order[k];
+		job->node = nodes[job->index];
+		job->m.fdt = fdt;
+		job->m.fdto = fdto;
+	}
+
+	for (i = 0; i < count; i++)
+		if (fdt_merge_dups_(fdt, fdto, nodes[i]))
+			return 1;
+
+	/* The new names go in first, in the order of the nodes merged */
+	strsize = fdt_size_dt_strings(fdt);
+	for (i = 0; i < count; i++)
+		if (fdt_merge_size_(fdt, -1, fdto, nodes[i], 1, &size, NULL))
+			goto rollback;
+
+	/*
+	 * A group grows by no more than its nodes would take as new
+	 * nodes; it is sized once merged.
+	 */
+	for (j = 0; j < njobs; j++) {
+		job = &jobs[j];
+		if (job->count == 1) {
+			if (fdt_merge_size_(fdt, job->nodeoffset, fdto,
+					    job->node, 0, &job->size,
+					    &phandle))
+				goto rollback;
+			continue;
+		}
+
+		for (bound = 0, i = 0; i < job->count; i++) {
+			if (fdt_merge_size_(fdt, -1, fdto, job->nodes[i], 0,
+					    &size, &phandle))
+				goto rollback;
+			bound += size;
+		}
+		size = fdt_merge_sub_(fdt, job, NULL, bound);
+		if ((size < 0) || (size > ((char *)buf + bufsize - sub)))
+			goto rollback;
+		job->sub = sub;
+		fdt_merge_sub_(fdt, job, sub, bound);
+		sub += size;
+	}
+
+	known = idx && !fdt_index_max_phandle_(idx, &max);
+
+	/* The jobs only read the tree, keep them away from the index */
+	if (idx)
+		fdt_index_detach(idx);
+
+	if (groups) {
+		fdt_merge_run_all_(jobs, njobs, threads, 1);
+		for (j = 0; j < njobs; j++) {
+			job = &jobs[j];
+			if (job->err)
+				goto reattach;
+			if (job->sub)
+				job->size = fdt_size_dt_struct(job->sub)
+					- FDT_TAGSIZE
+					- (job->end - job->nodeoffset);
+		}
+	}
+
+	/*
+	 * Only go ahead if fdt_merge_node_() would have had the room to
+	 * merge each job in turn, even with all the new names in.
+	 */
+	grown = 0;
+	for (i = 0; i < count; i++) {
+		for (j = 0; (j < njobs) && (jobs[j].index != i); j++)
+			;
+		if (j == njobs)
+			continue;
+		job = &jobs[j];
+		out = FDT_TAGALIGN(fdt_data_size_(fdt) + grown
+				   + (job->size > 0 ? job->size : 0));
+		if ((out < 0) || ((unsigned)out + (job->end - job->nodeoffset)
+				  + job->size > fdt_totalsize(fdt)))
+			goto reattach;
+		grown += job->size;
+	}
+
+	newstruct = (char *)FDT_ALIGN((uintptr_t)sub, sizeof(uint64_t));
+	newsize = structsize + grown;
+	if ((newstruct + newsize) > ((char *)buf + bufsize))
+		goto reattach;
+
+	grown = 0;
+	for (j = 0; j < njobs; j++) {
+		job = &jobs[j];
+		job->m.out = newstruct;
+		job->m.base = 0;
+		job->m.offsets = NULL;
+		job->m.count = 0;
+		job->gap = (j > 0) ? jobs[j - 1].end : 0;
+		job->pos = job->nodeoffset + grown;
+		grown += job->size;
+	}
+
+	fdt_merge_run_all_(jobs, njobs, threads, 0);
+
+	job = &jobs[njobs - 1];
+	memcpy(newstruct + job->end + grown,
+	       fdt_offset_ptr_(fdt, job->end), structsize - job->end);
+
+	/* There is room for it, so neither of these can fail */
+	fdt_splice_struct_(fdt, fdt_offset_ptr_w_(fdt, 0), structsize, newsize);
+	memcpy(fdt_offset_ptr_w_(fdt, 0), newstruct, newsize);
+
+	for (j = 0, k = 0; j < njobs; k += jobs[j++].count)
+		for (i = 0; i < jobs[j].count; i++)
+			targets[order[k + i]] = jobs[j].pos + offsets[k + i];
+
+	if (idx && !fdt_index_attach(idx)) {
+		fdt_index_rebuild_(fdt);
+		if (known && (phandle > max))
+			max = phandle;
+		if (known)
+			fdt_index_max_phandle_set_(idx, max);
+	}
+
+	return 0;
+
+reattach:
+	if (idx)
+		fdt_index_attach(idx);
+rollback:
+	fdt_set_size_dt_strings(fdt, strsize);
+	fdt_index_strings_trimmed_(fdt);
+	return 1;
+}
+
 static void fdt_packblocks_(const char *old, char *new,
 			    int mem_rsv_size,
 			    int struct_size,
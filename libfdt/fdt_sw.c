@@ -182,6 +182,7 @@ int fdt_resize(void *fdt, void *buf, int bufsize)
 	if (fdt_off_dt_strings(buf))
 		fdt_set_off_dt_strings(buf, bufsize);
 
+	fdt_index_moved_(fdt, buf);
 	return 0;
 }
 
@@ -261,6 +262,7 @@ static int fdt_add_string_(void *fdt, const char *s)
 
 	memcpy(strtab - offset, s, len);
 	fdt_set_size_dt_strings(fdt, strtabsize + len);
+	fdt_index_string_added_(fdt, -offset, len);
 	return -offset;
 }
 
@@ -271,19 +273,30 @@ static void fdt_del_last_string_(void *fdt, const char *s)
 	int len = strlen(s) + 1;
 
 	fdt_set_size_dt_strings(fdt, strtabsize - len);
+	fdt_index_strings_trimmed_(fdt);
 }
 
 static int fdt_find_add_string_(void *fdt, const char *s, int *allocated)
 {
 	char *strtab = (char *)fdt + fdt_totalsize(fdt);
 	int strtabsize = fdt_size_dt_strings(fdt);
+	struct fdt_index *idx = fdt_index_get_(fdt);
 	const char *p;
+	int offset, err;
 
 	*allocated = 0;
 
-	p = fdt_find_string_(strtab - strtabsize, strtabsize, s);
-	if (p)
-		return p - strtab;
+	err = idx ? fdt_index_string_find_(idx, s, strlen(s) + 1, &offset)
+		: -FDT_ERR_BADSTATE;
+	if (!err)
+		return offset;
+
+	/* No usable strings table, scan the block */
+	if (err == -FDT_ERR_BADSTATE) {
+		p = fdt_find_string_(strtab - strtabsize, strtabsize, s);
+		if (p)
+			return p - strtab;
+	}
 
 	*allocated = 1;
 
@@ -298,7 +311,10 @@ int fdt_property_placeholder(void *fdt, const char *name, int len, void **valp)
 
 	FDT_SW_PROBE_STRUCT(fdt);
 
-	/* String de-duplication can be slow, _NO_NAME_DEDUP skips it */
+	/*
+	 * String de-duplication can be slow, _NO_NAME_DEDUP skips it. An
+	 * attached strings table (fdt_index_strings()) makes it cheap.
+	 */
 	if (sw_flags(fdt) & FDT_CREATE_FLAG_NO_NAME_DEDUP) {
 		allocated = 1;
 		nameoff = fdt_add_string_(fdt, name);
@@ -380,5 +396,6 @@ int fdt_finish(void *fdt)
 	fdt_set_last_comp_version(fdt, FDT_LAST_COMPATIBLE_VERSION);
 	fdt_set_magic(fdt, FDT_MAGIC);
 
+	fdt_index_sw_finished_(fdt);
 	return 0;
 }
@@ -0,0 +1,1738 @@
+// SPDX-License-Identifier: (GPL-2.0-or-later OR BSD-2-Clause)
+/*
+ * libfdt - Flat Device Tree manipulation
+ *
+ * Transactions: edits recorded against a blob which is only read, and
+ * written out in a single pass over it.
+ */
+#include "libfdt_env.h"
+
+#include <fdt.h>
+#include <libfdt.h>
+
+#include "libfdt_internal.h"
+
+/*
+ * The memory of a transaction holds a hash table from base node offsets
+ * to node records, followed by the records, growing upwards. Names and
+ * property values are stored from the end of the memory downwards.
+ * Records refer to each other by their offset in that memory, with -1
+ * standing for none.
+ */
+#define FDT_TXN_NODE_MAGIC	0x74786e64	/* "txnd" */
+
+struct fdt_txn_node {
+	uint32_t magic;
+	int offset;	/* in the base blob, -1 for a new node */
+	int end;	/* deleted base nodes: offset past FDT_END_NODE */
+	int parent;	/* new nodes: record of the parent */
+	int name;	/* new nodes: NUL terminated name */
+	int namelen;
+	int props;	/* new and changed properties, newest first */
+	int children;	/* new subnodes, newest first */
+	int sibling;	/* next older new subnode of the same parent */
+	int deleted;
+	int next_deleted;
+};
+
+struct fdt_txn_prop {
+	int next;	/* next older record of the same node */
+	int node;	/* record of the node */
+	int offset;	/* in the base blob, -1 for a new property */
+	int nameoff;	/* in the strings block of the result */
+	int name;	/* NUL terminated name, -1 if in the base strings */
+	int namelen;
+	int val;
+	int len;	/* -1 once a base property is deleted */
+	int next_phandle;	/* next record of a phandle property */
+};
+
+struct fdt_txn_string {
+	int next;
+	int str;
+	int len;	/* including the terminator */
+	int pos;	/* offset past the base strings block */
+};
+
+enum {
+	FDT_TXN_COPY,	/* from the base blob */
+	FDT_TXN_MEM,	/* from the transaction memory */
+	FDT_TXN_WORD,	/* a structure block tag or field */
+	FDT_TXN_ZERO,
+};
+
+struct fdt_txn_piece {
+	int dest;
+	int src;
+	int len;
+	int kind;
+};
+
+static inline void *fdt_txn_at_(const struct fdt_txn *txn, int r)
+{
+	return txn->buf + r;
+}
+
+static inline struct fdt_txn_node *fdt_txn_node_at_(const struct fdt_txn *txn,
+						    int r)
+{
+	return fdt_txn_at_(txn, r);
+}
+
+static inline struct fdt_txn_prop *fdt_txn_prop_at_(const struct fdt_txn *txn,
+						    int r)
+{
+	return fdt_txn_at_(txn, r);
+}
+
+/* Offsets of new nodes lie past the end of the base structure block */
+static inline int fdt_txn_new_offset_(const struct fdt_txn *txn, int r)
+{
+	return fdt_size_dt_struct(txn->fdt) + r;
+}
+
+static int fdt_txn_alloc_(struct fdt_txn *txn, int size)
+{
+	int r = txn->top;
+
+	if (size > (txn->bottom - txn->top))
+		return -FDT_ERR_NOSPACE;
+
+	txn->top += size;
+	return r;
+}
+
+static int fdt_txn_alloc_data_(struct fdt_txn *txn, int len)
+{
+	if ((len < 0) || (len > (txn->bottom - txn->top)))
+		return -FDT_ERR_NOSPACE;
+
+	txn->bottom -= len;
+	return txn->bottom;
+}
+
+/*
+ * @len bytes of the transaction memory, 8-byte aligned, for the caller
+ * to use until the transaction is abandoned. Data is only ever reached
+ * through the offsets recorded for it, so nothing looks at them.
+ */
+void *fdt_txn_reserve_(struct fdt_txn *txn, int len)
+{
+	int r;
+
+	r = fdt_txn_alloc_data_(txn, len + sizeof(uint64_t) - 1);
+	if (r < 0)
+		return NULL;
+
+	return (void *)FDT_ALIGN((uintptr_t)(txn->buf + r), sizeof(uint64_t));
+}
+
+static int fdt_txn_slot_(const struct fdt_txn *txn, int offset)
+{
+	int h = (((uint32_t)offset >> 2) * 2654435761U) & txn->mask;
+
+	while ((txn->slots[h] >= 0)
+	       && (fdt_txn_node_at_(txn, txn->slots[h])->offset != offset))
+		h = (h + 1) & txn->mask;
+
+	return h;
+}
+
+/* Record of base node @offset, or -1 if the transaction did not touch it */
+static int fdt_txn_find_(const struct fdt_txn *txn, int offset)
+{
+	return txn->slots[fdt_txn_slot_(txn, offset)];
+}
+
+static int fdt_txn_base_deleted_(const struct fdt_txn *txn, int offset)
+{
+	const struct fdt_txn_node *n;
+	int r;
+
+	for (r = txn->deleted; r >= 0; r = n->next_deleted) {
+		n = fdt_txn_node_at_(txn, r);
+		if ((offset >= n->offset) && (offset < n->end))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check that @nodeoffset is a node of the edited tree, and find its
+ * record: *rp is -1 for a base node the transaction did not touch.
+ */
+static int fdt_txn_lookup_(const struct fdt_txn *txn, int nodeoffset, int *rp)
+{
+	const struct fdt_txn_node *n;
+	int size = fdt_size_dt_struct(txn->fdt);
+	int r, err;
+
+	if (nodeoffset < size) {
+		err = fdt_check_node_offset_(txn->fdt, nodeoffset);
+		if (err < 0)
+			return err;
+		if (fdt_txn_base_deleted_(txn, nodeoffset))
+			return -FDT_ERR_BADOFFSET;
+
+		*rp = fdt_txn_find_(txn, nodeoffset);
+		return 0;
+	}
+
+	r = nodeoffset - size;
+	if ((r & (FDT_TAGSIZE - 1))
+	    || (r < ((txn->mask + 1) * (int)sizeof(int)))
+	    || (r > (txn->top - (int)sizeof(*n))))
+		return -FDT_ERR_BADOFFSET;
+
+	*rp = r;
+	n = fdt_txn_node_at_(txn, r);
+	if (n->magic != FDT_TXN_NODE_MAGIC)
+		return -FDT_ERR_BADOFFSET;
+
+	/* A new node goes away with any of its ancestors */
+	for (; n->offset < 0; n = fdt_txn_node_at_(txn, n->parent))
+		if (n->deleted)
+			return -FDT_ERR_BADOFFSET;
+	if (fdt_txn_base_deleted_(txn, n->offset))
+		return -FDT_ERR_BADOFFSET;
+
+	return 0;
+}
+
+/* As fdt_txn_lookup_(), but gives base nodes a record if they lack one */
+static int fdt_txn_record_(struct fdt_txn *txn, int nodeoffset)
+{
+	struct fdt_txn_node *n;
+	int r, err;
+
+	err = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (err)
+		return err;
+	if (r >= 0)
+		return r;
+
+	if (txn->used >= ((txn->mask + 1) / 2))
+		return -FDT_ERR_NOSPACE;
+
+	r = fdt_txn_alloc_(txn, sizeof(*n));
+	if (r < 0)
+		return r;
+
+	n = fdt_txn_node_at_(txn, r);
+	memset(n, 0, sizeof(*n));
+	n->magic = FDT_TXN_NODE_MAGIC;
+	n->offset = nodeoffset;
+	n->parent = n->name = -1;
+	n->props = n->children = n->sibling = n->next_deleted = -1;
+	txn->slots[fdt_txn_slot_(txn, nodeoffset)] = r;
+	txn->used++;
+	return r;
+}
+
+/* Same matching rules as fdt_subnode_offset_namelen() */
+static int fdt_txn_nodename_eq_(const char *p, int plen, const char *s,
+				int len)
+{
+	if (!p || (plen < len) || (memcmp(p, s, len) != 0))
+		return 0;
+
+	if (p[len] == '\0')
+		return 1;
+	else if (!memchr(s, '@', len) && (p[len] == '@'))
+		return 1;
+	else
+		return 0;
+}
+
+static const char *fdt_txn_prop_name_(const struct fdt_txn *txn,
+				      const struct fdt_txn_prop *p)
+{
+	if (p->name < 0)
+		return (const char *)txn->fdt + fdt_off_dt_strings(txn->fdt)
+			+ p->nameoff;
+
+	return fdt_txn_at_(txn, p->name);
+}
+
+/* Record of base property @offset of a node, or -1 */
+static int fdt_txn_find_prop_(const struct fdt_txn *txn,
+			      const struct fdt_txn_node *n, int offset)
+{
+	int r;
+
+	for (r = n->props; r >= 0; r = fdt_txn_prop_at_(txn, r)->next)
+		if (fdt_txn_prop_at_(txn, r)->offset == offset)
+			return r;
+
+	return -1;
+}
+
+/*
+ * First property called @name of a node in the edited tree: the new
+ * properties, newest first, then the base ones. On success either *rp
+ * is a record, or it is -1 and *offsetp is an unchanged base property.
+ * @n is the record of the node, NULL for an untouched base node.
+ */
+static int fdt_txn_get_prop_(const struct fdt_txn *txn, int nodeoffset,
+			     const struct fdt_txn_node *n, const char *name,
+			     int namelen, int *rp, int *offsetp)
+{
+	const void *fdt = txn->fdt;
+	const struct fdt_property *prop;
+	int r, offset;
+
+	if (n) {
+		for (r = n->props; r >= 0; r = fdt_txn_prop_at_(txn, r)->next) {
+			const struct fdt_txn_prop *p = fdt_txn_prop_at_(txn, r);
+
+			if ((p->offset < 0) && (p->namelen == namelen)
+			    && (memcmp(fdt_txn_prop_name_(txn, p), name,
+				       namelen) == 0)) {
+				*rp = r;
+				return 0;
+			}
+		}
+
+		if (n->offset < 0)
+			return -FDT_ERR_NOTFOUND;
+		nodeoffset = n->offset;
+	}
+
+	/*
+	 * The first base property of that name, which an index may find
+	 * quickly, is the answer unless it was deleted.
+	 */
+	prop = fdt_get_property_namelen(fdt, nodeoffset, name, namelen,
+					&offset);
+	if (!prop)
+		return offset;
+
+	offset = (const char *)prop - (const char *)fdt_offset_ptr_(fdt, 0);
+	r = n ? fdt_txn_find_prop_(txn, n, offset) : -1;
+	if ((r < 0) || (fdt_txn_prop_at_(txn, r)->len >= 0)) {
+		*rp = r;
+		*offsetp = offset;
+		return 0;
+	}
+
+	fdt_for_each_property_offset(offset, fdt, nodeoffset) {
+		const char *s;
+		int slen;
+
+		prop = fdt_get_property_by_offset(fdt, offset, NULL);
+		if (!prop)
+			return -FDT_ERR_INTERNAL;
+
+		s = fdt_get_string(fdt, fdt32_ld_(&prop->nameoff), &slen);
+		if (!s || (slen != namelen) || (memcmp(s, name, namelen) != 0))
+			continue;
+
+		r = n ? fdt_txn_find_prop_(txn, n, offset) : -1;
+		if ((r >= 0) && (fdt_txn_prop_at_(txn, r)->len < 0))
+			continue;
+
+		*rp = r;
+		*offsetp = offset;
+		return 0;
+	}
+
+	return offset;
+}
+
+/*
+ * Offset of @s in the strings block of the result, adding it at the end
+ * if needed. Like fdt_find_add_string_(), the first occurrence wins,
+ * including as the tail of a longer name. *namep is set to where the
+ * name is stored in the transaction memory, -1 if in the base blob.
+ */
+static int fdt_txn_find_add_string_(struct fdt_txn *txn, const char *s,
+				    int *namep)
+{
+	const void *fdt = txn->fdt;
+	const char *strtab = (const char *)fdt + fdt_off_dt_strings(fdt);
+	int strsize = fdt_size_dt_strings(fdt);
+	int len = strlen(s) + 1;
+	struct fdt_txn_string *e;
+	struct fdt_index *idx;
+	const char *p;
+	int r, offset, err = -FDT_ERR_BADSTATE;
+
+	*namep = -1;
+	idx = fdt_index_get_(fdt);
+	if (idx)
+		err = fdt_index_string_find_(idx, s, len, &offset);
+	if (!err)
+		return offset;
+	if (err == -FDT_ERR_BADSTATE) {
+		p = fdt_find_string_(strtab, strsize, s);
+		if (p)
+			return p - strtab;
+	}
+
+	for (r = txn->strings; r >= 0; r = e->next) {
+		e = fdt_txn_at_(txn, r);
+		if ((e->len >= len)
+		    && (memcmp((char *)fdt_txn_at_(txn, e->str) + e->len - len,
+			       s, len) == 0)) {
+			*namep = e->str + e->len - len;
+			return strsize + e->pos + e->len - len;
+		}
+	}
+
+	r = fdt_txn_alloc_(txn, sizeof(*e));
+	if (r < 0)
+		return r;
+	offset = fdt_txn_alloc_data_(txn, len);
+	if (offset < 0)
+		return offset;
+
+	memcpy(fdt_txn_at_(txn, offset), s, len);
+	e = fdt_txn_at_(txn, r);
+	e->next = -1;
+	e->str = offset;
+	e->len = len;
+	e->pos = txn->strsize;
+	if (txn->last_string >= 0) {
+		struct fdt_txn_string *last;
+
+		last = fdt_txn_at_(txn, txn->last_string);
+		last->next = r;
+	} else {
+		txn->strings = r;
+	}
+	txn->last_string = r;
+	txn->strsize += len;
+
+	*namep = offset;
+	return strsize + e->pos;
+}
+
+/* New property record for node record @nr */
+static int fdt_txn_add_prop_(struct fdt_txn *txn, int nr, int offset,
+			     int nameoff, int name, int namelen)
+{
+	struct fdt_txn_node *n;
+	struct fdt_txn_prop *p;
+	int r;
+
+	r = fdt_txn_alloc_(txn, sizeof(*p));
+	if (r < 0)
+		return r;
+
+	n = fdt_txn_node_at_(txn, nr);
+	p = fdt_txn_prop_at_(txn, r);
+	p->next = n->props;
+	p->node = nr;
+	p->offset = offset;
+	p->nameoff = nameoff;
+	p->name = name;
+	p->namelen = namelen;
+	p->val = -1;
+	p->len = 0;
+	p->next_phandle = -1;
+	n->props = r;
+
+	if (fdt_index_is_phandle_name_(fdt_txn_prop_name_(txn, p), namelen)) {
+		p->next_phandle = txn->phandles;
+		txn->phandles = r;
+	}
+
+	return r;
+}
+
+int fdt_txn_init(struct fdt_txn *txn, const void *fdt, void *buf, int bufsize)
+{
+	int nslots, i;
+
+	FDT_RO_PROBE(fdt);
+
+	if (!can_assume(LATEST) && (fdt_version(fdt) < 17))
+		return -FDT_ERR_BADVERSION;
+	if (fdt_blocks_misordered_(fdt, sizeof(struct fdt_reserve_entry),
+				   fdt_size_dt_struct(fdt)))
+		return -FDT_ERR_BADLAYOUT;
+
+	if ((uintptr_t)buf & (sizeof(int) - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	/* An eighth of the memory goes to the node hash table */
+	if ((bufsize < 0) || (bufsize < (16 * (int)sizeof(int))))
+		return -FDT_ERR_NOSPACE;
+	for (nslots = 2; (nslots * 2 * sizeof(int)) <= (unsigned)bufsize / 8;
+	     nslots *= 2)
+		;
+
+	memset(txn, 0, sizeof(*txn));
+	txn->fdt = fdt;
+	txn->buf = buf;
+	txn->bufsize = bufsize;
+	txn->slots = buf;
+	txn->mask = nslots - 1;
+	txn->top = nslots * sizeof(int);
+	txn->bottom = bufsize;
+	txn->strings = txn->last_string = -1;
+	txn->deleted = -1;
+	txn->phandles = -1;
+	txn->size = txn->peak = fdt_off_dt_strings(fdt)
+		+ fdt_size_dt_strings(fdt);
+	for (i = 0; i < nslots; i++)
+		txn->slots[i] = -1;
+
+	return 0;
+}
+
+/**********************************************************************/
+/* Edits                                                              */
+/**********************************************************************/
+
+/*
+ * Track the size the blob would have after each edit made with the
+ * read-write functions, and the most it has reached on the way.
+ */
+static void fdt_txn_resized_(struct fdt_txn *txn, int size)
+{
+	txn->size = size;
+	if (size > txn->peak)
+		txn->peak = size;
+}
+
+int fdt_txn_setprop_placeholder(struct fdt_txn *txn, int nodeoffset,
+				const char *name, int len, void **prop_data)
+{
+	struct fdt_txn_prop *p;
+	int namelen = strlen(name);
+	int nr, r, offset, nameoff, namep, val, oldlen, err;
+	int strsize = txn->strsize;
+
+	txn->edited = 1;
+
+	nr = fdt_txn_record_(txn, nodeoffset);
+	if (nr < 0)
+		return nr;
+
+	err = fdt_txn_get_prop_(txn, nodeoffset, fdt_txn_node_at_(txn, nr),
+				name, namelen, &r, &offset);
+	if (err && (err != -FDT_ERR_NOTFOUND))
+		return err;
+
+	val = fdt_txn_alloc_data_(txn, len);
+	if (val < 0)
+		return val;
+
+	if (err) {
+		nameoff = fdt_txn_find_add_string_(txn, name, &namep);
+		if (nameoff < 0)
+			return nameoff;
+		r = fdt_txn_add_prop_(txn, nr, -1, nameoff, namep, namelen);
+		oldlen = -1;
+	} else if (r < 0) {
+		const struct fdt_property *prop;
+
+		prop = fdt_get_property_by_offset(txn->fdt, offset, NULL);
+		r = fdt_txn_add_prop_(txn, nr, offset,
+				      fdt32_ld_(&prop->nameoff), -1, namelen);
+		oldlen = fdt32_ld_(&prop->len);
+	} else {
+		oldlen = fdt_txn_prop_at_(txn, r)->len;
+	}
+	if (r < 0)
+		return r;
+
+	if (oldlen < 0)
+		fdt_txn_resized_(txn, txn->size + (txn->strsize - strsize)
+				 + sizeof(struct fdt_property)
+				 + FDT_TAGALIGN(len));
+	else
+		fdt_txn_resized_(txn, txn->size + FDT_TAGALIGN(len)
+				 - FDT_TAGALIGN(oldlen));
+
+	p = fdt_txn_prop_at_(txn, r);
+	p->val = val;
+	p->len = len;
+	*prop_data = fdt_txn_at_(txn, val);
+	return 0;
+}
+
+int fdt_txn_setprop(struct fdt_txn *txn, int nodeoffset, const char *name,
+		    const void *val, int len)
+{
+	void *prop_data;
+	int err;
+
+	err = fdt_txn_setprop_placeholder(txn, nodeoffset, name, len,
+					  &prop_data);
+	if (err)
+		return err;
+
+	if (len)
+		memcpy(prop_data, val, len);
+	return 0;
+}
+
+int fdt_txn_delprop(struct fdt_txn *txn, int nodeoffset, const char *name)
+{
+	struct fdt_txn_node *n;
+	struct fdt_txn_prop *p;
+	int namelen = strlen(name);
+	int nr, r, *rp, offset, err;
+
+	txn->edited = 1;
+
+	nr = fdt_txn_record_(txn, nodeoffset);
+	if (nr < 0)
+		return nr;
+
+	n = fdt_txn_node_at_(txn, nr);
+	err = fdt_txn_get_prop_(txn, nodeoffset, n, name, namelen, &r,
+				&offset);
+	if (err)
+		return err;
+
+	if (r < 0) {
+		const struct fdt_property *prop;
+
+		prop = fdt_get_property_by_offset(txn->fdt, offset, NULL);
+		r = fdt_txn_add_prop_(txn, nr, offset,
+				      fdt32_ld_(&prop->nameoff), -1, namelen);
+		if (r < 0)
+			return r;
+		fdt_txn_prop_at_(txn, r)->len = fdt32_ld_(&prop->len);
+	}
+
+	p = fdt_txn_prop_at_(txn, r);
+	fdt_txn_resized_(txn, txn->size - sizeof(struct fdt_property)
+			 - FDT_TAGALIGN(p->len));
+	p->len = -1;
+
+	/* A new property simply goes away */
+	if (p->offset < 0) {
+		for (rp = &n->props; *rp != r;
+		     rp = &fdt_txn_prop_at_(txn, *rp)->next)
+			;
+		*rp = p->next;
+	}
+
+	return 0;
+}
+
+int fdt_txn_add_subnode_namelen(struct fdt_txn *txn, int parentoffset,
+				const char *name, int namelen)
+{
+	struct fdt_txn_node *n, *parent;
+	int pr, r, offset;
+
+	txn->edited = 1;
+
+	offset = fdt_txn_subnode_offset_namelen(txn, parentoffset, name,
+						namelen);
+	if (offset >= 0)
+		return -FDT_ERR_EXISTS;
+	else if (offset != -FDT_ERR_NOTFOUND)
+		return offset;
+
+	pr = fdt_txn_record_(txn, parentoffset);
+	if (pr < 0)
+		return pr;
+
+	r = fdt_txn_alloc_(txn, sizeof(*n));
+	if (r < 0)
+		return r;
+	offset = fdt_txn_alloc_data_(txn, namelen + 1);
+	if (offset < 0)
+		return offset;
+
+	memcpy(fdt_txn_at_(txn, offset), name, namelen);
+	((char *)fdt_txn_at_(txn, offset))[namelen] = '\0';
+
+	n = fdt_txn_node_at_(txn, r);
+	parent = fdt_txn_node_at_(txn, pr);
+	memset(n, 0, sizeof(*n));
+	n->magic = FDT_TXN_NODE_MAGIC;
+	n->offset = -1;
+	n->parent = pr;
+	n->name = offset;
+	n->namelen = namelen;
+	n->props = n->children = n->next_deleted = -1;
+	n->sibling = parent->children;
+	parent->children = r;
+
+	fdt_txn_resized_(txn, txn->size + sizeof(struct fdt_node_header)
+			 + FDT_TAGALIGN(namelen + 1) + FDT_TAGSIZE);
+	return fdt_txn_new_offset_(txn, r);
+}
+
+int fdt_txn_add_subnode(struct fdt_txn *txn, int parentoffset,
+			const char *name)
+{
+	return fdt_txn_add_subnode_namelen(txn, parentoffset, name,
+					   strlen(name));
+}
+
+/* Defined with the writing of the result, whose walk it reuses */
+static int fdt_txn_node_size_(const struct fdt_txn *txn, int r,
+			      int nodeoffset, int end);
+
+int fdt_txn_del_node(struct fdt_txn *txn, int nodeoffset)
+{
+	struct fdt_txn_node *n;
+	int r, *rp, endoffset, size, err;
+
+	txn->edited = 1;
+
+	err = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (err)
+		return err;
+
+	/* Only the deleted subtree is sized, as it stands in the edits */
+	if ((r >= 0) && (fdt_txn_node_at_(txn, r)->offset < 0)) {
+		size = fdt_txn_node_size_(txn, r, -1, -1);
+		n = fdt_txn_node_at_(txn, r);
+		for (rp = &fdt_txn_node_at_(txn, n->parent)->children; *rp != r;
+		     rp = &fdt_txn_node_at_(txn, *rp)->sibling)
+			;
+		*rp = n->sibling;
+		n->deleted = 1;
+		fdt_txn_resized_(txn, txn->size - size);
+		return 0;
+	}
+
+	endoffset = fdt_node_end_offset_((void *)(uintptr_t)txn->fdt,
+					 nodeoffset);
+	if (endoffset < 0)
+		return endoffset;
+
+	size = fdt_txn_node_size_(txn, -1, nodeoffset, endoffset);
+	if (size < 0)
+		return size;
+
+	r = fdt_txn_record_(txn, nodeoffset);
+	if (r < 0)
+		return r;
+
+	n = fdt_txn_node_at_(txn, r);
+	n->deleted = 1;
+	n->end = endoffset;
+	n->next_deleted = txn->deleted;
+	txn->deleted = r;
+	fdt_txn_resized_(txn, txn->size - size);
+	return 0;
+}
+
+/**********************************************************************/
+/* Reading the edited tree                                            */
+/**********************************************************************/
+
+const void *fdt_txn_getprop_namelen(const struct fdt_txn *txn,
+				    int nodeoffset, const char *name,
+				    int namelen, int *lenp)
+{
+	const struct fdt_txn_prop *p;
+	int r, offset, err;
+
+	err = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (!err)
+		err = fdt_txn_get_prop_(txn, nodeoffset,
+				(r >= 0) ? fdt_txn_node_at_(txn, r) : NULL,
+				name, namelen, &r, &offset);
+	if (err) {
+		if (lenp)
+			*lenp = err;
+		return NULL;
+	}
+
+	if (r < 0)
+		return fdt_getprop_by_offset(txn->fdt, offset, NULL, lenp);
+
+	p = fdt_txn_prop_at_(txn, r);
+	if (lenp)
+		*lenp = p->len;
+	return fdt_txn_at_(txn, p->val);
+}
+
+const void *fdt_txn_getprop(const struct fdt_txn *txn, int nodeoffset,
+			    const char *name, int *lenp)
+{
+	return fdt_txn_getprop_namelen(txn, nodeoffset, name, strlen(name),
+				       lenp);
+}
+
+uint32_t fdt_txn_get_phandle(const struct fdt_txn *txn, int nodeoffset)
+{
+	const fdt32_t *php;
+	int len;
+
+	php = fdt_txn_getprop(txn, nodeoffset, "phandle", &len);
+	if (!php || (len != sizeof(*php))) {
+		php = fdt_txn_getprop(txn, nodeoffset, "linux,phandle", &len);
+		if (!php || (len != sizeof(*php)))
+			return 0;
+	}
+
+	return fdt32_ld(php);
+}
+
+const char *fdt_txn_get_name(const struct fdt_txn *txn, int nodeoffset,
+			     int *lenp)
+{
+	const struct fdt_txn_node *n;
+	int r, err;
+
+	err = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (err) {
+		if (lenp)
+			*lenp = err;
+		return NULL;
+	}
+
+	if ((r < 0) || (fdt_txn_node_at_(txn, r)->offset >= 0))
+		return fdt_get_name(txn->fdt, nodeoffset, lenp);
+
+	n = fdt_txn_node_at_(txn, r);
+	if (lenp)
+		*lenp = n->namelen;
+	return fdt_txn_at_(txn, n->name);
+}
+
+int fdt_txn_parent_offset(const struct fdt_txn *txn, int nodeoffset)
+{
+	const struct fdt_txn_node *parent;
+	int r, err;
+
+	err = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (err)
+		return err;
+
+	if ((r < 0) || (fdt_txn_node_at_(txn, r)->offset >= 0))
+		return fdt_parent_offset(txn->fdt, nodeoffset);
+
+	r = fdt_txn_node_at_(txn, r)->parent;
+	parent = fdt_txn_node_at_(txn, r);
+	return (parent->offset >= 0) ? parent->offset
+		: fdt_txn_new_offset_(txn, r);
+}
+
+int fdt_txn_subnode_offset_namelen(const struct fdt_txn *txn, int parentoffset,
+				   const char *name, int namelen)
+{
+	const struct fdt_txn_node *n = NULL;
+	int r, offset, err;
+
+	err = fdt_txn_lookup_(txn, parentoffset, &r);
+	if (err)
+		return err;
+
+	/* New subnodes come first, newest first */
+	if (r >= 0) {
+		n = fdt_txn_node_at_(txn, r);
+		for (r = n->children; r >= 0;
+		     r = fdt_txn_node_at_(txn, r)->sibling) {
+			const struct fdt_txn_node *c = fdt_txn_node_at_(txn, r);
+
+			if (fdt_txn_nodename_eq_(fdt_txn_at_(txn, c->name),
+						 c->namelen, name, namelen))
+				return fdt_txn_new_offset_(txn, r);
+		}
+
+		if (n->offset < 0)
+			return -FDT_ERR_NOTFOUND;
+		parentoffset = n->offset;
+	}
+
+	offset = fdt_subnode_offset_namelen(txn->fdt, parentoffset, name,
+					    namelen);
+
+	/* Skip the matches deleted by the transaction */
+	while ((offset >= 0) && (txn->deleted >= 0)
+	       && ((r = fdt_txn_find_(txn, offset)) >= 0)
+	       && fdt_txn_node_at_(txn, r)->deleted) {
+		const char *s;
+		int slen;
+
+		do {
+			offset = fdt_next_subnode(txn->fdt, offset);
+			if (offset < 0)
+				break;
+			s = fdt_get_name(txn->fdt, offset, &slen);
+		} while (!fdt_txn_nodename_eq_(s, slen, name, namelen));
+	}
+
+	return offset;
+}
+
+int fdt_txn_subnode_offset(const struct fdt_txn *txn, int parentoffset,
+			   const char *name)
+{
+	return fdt_txn_subnode_offset_namelen(txn, parentoffset, name,
+					      strlen(name));
+}
+
+int fdt_txn_path_offset_namelen(const struct fdt_txn *txn, const char *path,
+				int namelen)
+{
+	const char *end = path + namelen;
+	const char *p = path;
+	int offset = 0;
+
+	/* see if we have an alias */
+	if (*path != '/') {
+		const char *q = memchr(path, '/', end - p);
+		int aliasoffset;
+
+		if (!q)
+			q = end;
+
+		aliasoffset = fdt_txn_path_offset(txn, "/aliases");
+		if (aliasoffset < 0)
+			return -FDT_ERR_BADPATH;
+		p = fdt_txn_getprop_namelen(txn, aliasoffset, p, q - p, NULL);
+		if (!p)
+			return -FDT_ERR_BADPATH;
+		offset = fdt_txn_path_offset(txn, p);
+
+		p = q;
+	}
+
+	while (p < end) {
+		const char *q;
+
+		while (*p == '/') {
+			p++;
+			if (p == end)
+				return offset;
+		}
+		q = memchr(p, '/', end - p);
+		if (!q)
+			q = end;
+
+		offset = fdt_txn_subnode_offset_namelen(txn, offset, p, q - p);
+		if (offset < 0)
+			return offset;
+
+		p = q;
+	}
+
+	return offset;
+}
+
+int fdt_txn_path_offset(const struct fdt_txn *txn, const char *path)
+{
+	return fdt_txn_path_offset_namelen(txn, path, strlen(path));
+}
+
+/*
+ * Visit the nodes of the edited tree from @nodeoffset down, in the
+ * order they will have in the result, until @fn returns non-zero.
+ */
+static int fdt_txn_walk_(const struct fdt_txn *txn, int nodeoffset,
+			 int (*fn)(const struct fdt_txn *txn, int nodeoffset,
+				   void *arg),
+			 void *arg)
+{
+	const struct fdt_txn_node *n = NULL;
+	int r, child, ret;
+
+	ret = fn(txn, nodeoffset, arg);
+	if (ret)
+		return ret;
+
+	ret = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (ret)
+		return ret;
+
+	if (r >= 0) {
+		n = fdt_txn_node_at_(txn, r);
+		for (r = n->children; r >= 0;
+		     r = fdt_txn_node_at_(txn, r)->sibling) {
+			ret = fdt_txn_walk_(txn, fdt_txn_new_offset_(txn, r),
+					    fn, arg);
+			if (ret)
+				return ret;
+		}
+
+		if (n->offset < 0)
+			return 0;
+	}
+
+	fdt_for_each_subnode(child, txn->fdt, nodeoffset) {
+		r = fdt_txn_find_(txn, child);
+		if ((r >= 0) && fdt_txn_node_at_(txn, r)->deleted)
+			continue;
+
+		ret = fdt_txn_walk_(txn, child, fn, arg);
+		if (ret)
+			return ret;
+	}
+	if (child != -FDT_ERR_NOTFOUND)
+		return child;
+
+	return 0;
+}
+
+/*
+ * Whether the transaction may have changed which node holds @phandle:
+ * it gave some node that phandle, took it away, or left a node with a
+ * "phandle" property which is not a phandle.
+ */
+static int fdt_txn_phandle_moved_(const struct fdt_txn *txn, uint32_t phandle)
+{
+	const struct fdt_txn_prop *p;
+	int r;
+
+	for (r = txn->phandles; r >= 0; r = p->next_phandle) {
+		p = fdt_txn_prop_at_(txn, r);
+		if (p->len == sizeof(fdt32_t)) {
+			if (fdt32_ld(fdt_txn_at_(txn, p->val)) == phandle)
+				return 1;
+		} else if ((p->offset >= 0) || (fdt_txn_node_at_(txn,
+						 p->node)->offset >= 0)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+struct fdt_txn_phandle_arg {
+	uint32_t phandle;
+	int offset;
+};
+
+static int fdt_txn_match_phandle_(const struct fdt_txn *txn, int nodeoffset,
+				  void *arg)
+{
+	struct fdt_txn_phandle_arg *a = arg;
+
+	if (fdt_txn_get_phandle(txn, nodeoffset) != a->phandle)
+		return 0;
+
+	a->offset = nodeoffset;
+	return 1;
+}
+
+int fdt_txn_node_offset_by_phandle(const struct fdt_txn *txn, uint32_t phandle)
+{
+	struct fdt_txn_phandle_arg a;
+	int offset, ret;
+
+	if ((phandle == 0) || (phandle == ~0U))
+		return -FDT_ERR_BADPHANDLE;
+
+	/* The base blob knows, unless the transaction interferes */
+	if (!fdt_txn_phandle_moved_(txn, phandle)) {
+		offset = fdt_node_offset_by_phandle(txn->fdt, phandle);
+		if ((offset < 0)
+		    || (!fdt_txn_base_deleted_(txn, offset)
+			&& (fdt_txn_get_phandle(txn, offset) == phandle)))
+			return offset;
+	}
+
+	a.phandle = phandle;
+	ret = fdt_txn_walk_(txn, 0, fdt_txn_match_phandle_, &a);
+	if (ret < 0)
+		return ret;
+
+	return ret ? a.offset : -FDT_ERR_NOTFOUND;
+}
+
+static int fdt_txn_max_phandle_(const struct fdt_txn *txn, int nodeoffset,
+				void *arg)
+{
+	uint32_t *max = arg;
+	uint32_t phandle = fdt_txn_get_phandle(txn, nodeoffset);
+
+	if (phandle > *max)
+		*max = phandle;
+	return 0;
+}
+
+/*
+ * As fdt_txn_find_max_phandle(), with @base_max, if not NULL, the
+ * highest phandle of the base blob as already found by the caller.
+ */
+int fdt_txn_find_max_phandle_(const struct fdt_txn *txn,
+			      const uint32_t *base_max, uint32_t *phandle)
+{
+	const struct fdt_txn_prop *p;
+	uint32_t max = 0;
+	int r, err;
+
+	for (r = txn->phandles; r >= 0; r = p->next_phandle) {
+		p = fdt_txn_prop_at_(txn, r);
+		if (fdt_txn_node_at_(txn, p->node)->offset >= 0)
+			break;
+	}
+
+	/* Unless base nodes lost phandles, only new nodes can add any */
+	if ((r < 0) && (txn->deleted < 0)) {
+		if (base_max) {
+			max = *base_max;
+		} else {
+			err = fdt_find_max_phandle(txn->fdt, &max);
+			if (err)
+				return err;
+		}
+
+		for (r = txn->phandles; r >= 0; r = p->next_phandle) {
+			p = fdt_txn_prop_at_(txn, r);
+			err = fdt_txn_max_phandle_(txn,
+				fdt_txn_new_offset_(txn, p->node), &max);
+			if (err)
+				return err;
+		}
+	} else {
+		err = fdt_txn_walk_(txn, 0, fdt_txn_max_phandle_, &max);
+		if (err)
+			return err;
+	}
+
+	if (phandle)
+		*phandle = max;
+	return 0;
+}
+
+int fdt_txn_find_max_phandle(const struct fdt_txn *txn, uint32_t *phandle)
+{
+	return fdt_txn_find_max_phandle_(txn, NULL, phandle);
+}
+
+/* Writes the path of @nodeoffset, returning its length */
+static int fdt_txn_get_path_(const struct fdt_txn *txn, int nodeoffset,
+			     char *buf, int buflen)
+{
+	const struct fdt_txn_node *n;
+	int r, p, err;
+
+	err = fdt_txn_lookup_(txn, nodeoffset, &r);
+	if (err)
+		return err;
+
+	if ((r < 0) || (fdt_txn_node_at_(txn, r)->offset >= 0)) {
+		err = fdt_get_path(txn->fdt, nodeoffset, buf, buflen);
+		if (err)
+			return err;
+		return strlen(buf);
+	}
+
+	n = fdt_txn_node_at_(txn, r);
+	p = fdt_txn_get_path_(txn, fdt_txn_parent_offset(txn, nodeoffset),
+			      buf, buflen);
+	if (p < 0)
+		return p;
+
+	/* The root is "/", not "" */
+	if (p == 1)
+		p = 0;
+	if ((p + 1 + n->namelen + 1) > buflen)
+		return -FDT_ERR_NOSPACE;
+
+	buf[p++] = '/';
+	memcpy(buf + p, fdt_txn_at_(txn, n->name), n->namelen);
+	p += n->namelen;
+	buf[p] = '\0';
+	return p;
+}
+
+int fdt_txn_get_path(const struct fdt_txn *txn, int nodeoffset, char *buf,
+		     int buflen)
+{
+	int ret;
+
+	if (buflen < 2)
+		return -FDT_ERR_NOSPACE;
+
+	ret = fdt_txn_get_path_(txn, nodeoffset, buf, buflen);
+	return (ret < 0) ? ret : 0;
+}
+
+/**********************************************************************/
+/* Writing the result                                                 */
+/**********************************************************************/
+
+struct fdt_txn_out {
+	const struct fdt_txn *txn;
+	char *buf;	/* NULL to only measure the result */
+	int bufsize;
+	int pos;
+	int plan;	/* next piece of an in-place commit, else -1 */
+	int last;	/* last piece recorded, -1 for none */
+	int err;
+};
+
+/*
+ * Emit @len bytes. Writing in place cannot just copy, as the base is
+ * overwritten as it goes: the pieces are recorded instead, and played
+ * back once the size of the result is known to fit.
+ */
+static void fdt_txn_out_(struct fdt_txn_out *o, int kind, int src, int len)
+{
+	const struct fdt_txn *txn = o->txn;
+	struct fdt_txn_piece *piece;
+
+	if (len <= 0)
+		return;
+
+	if (o->plan >= 0) {
+		piece = (o->last >= 0) ? fdt_txn_at_(txn, o->last) : NULL;
+		if (piece && (kind == FDT_TXN_COPY) && (piece->kind == kind)
+		    && ((piece->src + piece->len) == src)
+		    && ((piece->dest + piece->len) == o->pos)) {
+			piece->len += len;
+		} else if ((int)sizeof(*piece) > (txn->bottom - o->plan)) {
+			o->err = -FDT_ERR_NOSPACE;
+		} else {
+			piece = fdt_txn_at_(txn, o->plan);
+			piece->dest = o->pos;
+			piece->src = src;
+			piece->len = len;
+			piece->kind = kind;
+			o->last = o->plan;
+			o->plan += sizeof(*piece);
+		}
+	} else if (o->buf) {
+		char *p = o->buf + o->pos;
+
+		if ((o->pos > o->bufsize) || (len > (o->bufsize - o->pos)))
+			o->err = -FDT_ERR_NOSPACE;
+		else if (kind == FDT_TXN_COPY)
+			memcpy(p, (const char *)txn->fdt + src, len);
+		else if (kind == FDT_TXN_MEM)
+			memcpy(p, fdt_txn_at_(txn, src), len);
+		else if (kind == FDT_TXN_WORD)
+			*(fdt32_t *)p = cpu_to_fdt32(src);
+		else
+			memset(p, 0, len);
+	}
+
+	o->pos += len;
+}
+
+static void fdt_txn_out_prop_(struct fdt_txn_out *o,
+			      const struct fdt_txn_prop *p)
+{
+	fdt_txn_out_(o, FDT_TXN_WORD, FDT_PROP, FDT_TAGSIZE);
+	fdt_txn_out_(o, FDT_TXN_WORD, p->len, FDT_TAGSIZE);
+	fdt_txn_out_(o, FDT_TXN_WORD, p->nameoff, FDT_TAGSIZE);
+	fdt_txn_out_(o, FDT_TXN_MEM, p->val, p->len);
+	fdt_txn_out_(o, FDT_TXN_ZERO, 0, FDT_TAGALIGN(p->len) - p->len);
+}
+
+static void fdt_txn_out_new_props_(struct fdt_txn_out *o,
+				   const struct fdt_txn_node *n)
+{
+	const struct fdt_txn_prop *p;
+	int r;
+
+	for (r = n->props; r >= 0; r = p->next) {
+		p = fdt_txn_prop_at_(o->txn, r);
+		if (p->offset < 0)
+			fdt_txn_out_prop_(o, p);
+	}
+}
+
+/* Emit the new node recorded at @r, and its older siblings if @siblings */
+static void fdt_txn_out_new_nodes_(struct fdt_txn_out *o, int r,
+				   bool siblings)
+{
+	const struct fdt_txn_node *c;
+
+	for (; r >= 0; r = siblings ? c->sibling : -1) {
+		c = fdt_txn_node_at_(o->txn, r);
+
+		fdt_txn_out_(o, FDT_TXN_WORD, FDT_BEGIN_NODE, FDT_TAGSIZE);
+		fdt_txn_out_(o, FDT_TXN_MEM, c->name, c->namelen + 1);
+		fdt_txn_out_(o, FDT_TXN_ZERO, 0,
+			     FDT_TAGALIGN(c->namelen + 1) - (c->namelen + 1));
+		fdt_txn_out_new_props_(o, c);
+		fdt_txn_out_new_nodes_(o, c->children, true);
+		fdt_txn_out_(o, FDT_TXN_WORD, FDT_END_NODE, FDT_TAGSIZE);
+	}
+}
+
+/*
+ * The edits land where the read-write functions put them: new
+ * properties right after the node name, new subnodes after the
+ * properties, both newest first. The base structure block is walked
+ * from @offset up to @end, or up to FDT_END.
+ */
+static int fdt_txn_out_nodes_(struct fdt_txn_out *o, int offset, int end)
+{
+	const struct fdt_txn *txn = o->txn;
+	const void *fdt = txn->fdt;
+	int base = fdt_off_dt_struct(fdt);
+	int nextoffset, r, cur = -1;
+	const struct fdt_txn_prop *p;
+	const struct fdt_txn_node *n;
+	uint32_t tag;
+
+	do {
+		tag = fdt_next_tag(fdt, offset, &nextoffset);
+		if (nextoffset < 0)
+			return nextoffset;
+
+		if ((cur >= 0) && (tag != FDT_PROP) && (tag != FDT_NOP)) {
+			fdt_txn_out_new_nodes_(o,
+				fdt_txn_node_at_(txn, cur)->children, true);
+			cur = -1;
+		}
+
+		switch (tag) {
+		case FDT_BEGIN_NODE:
+			r = fdt_txn_find_(txn, offset);
+			n = (r >= 0) ? fdt_txn_node_at_(txn, r) : NULL;
+			if (n && n->deleted) {
+				nextoffset = n->end;
+				break;
+			}
+
+			fdt_txn_out_(o, FDT_TXN_COPY, base + offset,
+				     nextoffset - offset);
+			if (n) {
+				fdt_txn_out_new_props_(o, n);
+				cur = r;
+			}
+			break;
+
+		case FDT_PROP:
+			r = (cur >= 0) ? fdt_txn_find_prop_(txn,
+				fdt_txn_node_at_(txn, cur), offset) : -1;
+			if (r < 0) {
+				fdt_txn_out_(o, FDT_TXN_COPY, base + offset,
+					     nextoffset - offset);
+				break;
+			}
+
+			p = fdt_txn_prop_at_(txn, r);
+			if (p->len >= 0)
+				fdt_txn_out_prop_(o, p);
+			break;
+
+		default:
+			fdt_txn_out_(o, FDT_TXN_COPY, base + offset,
+				     nextoffset - offset);
+		}
+
+		offset = nextoffset;
+	} while ((tag != FDT_END) && (offset < end));
+
+	return offset;
+}
+
+static int fdt_txn_out_struct_(struct fdt_txn_out *o)
+{
+	const void *fdt = o->txn->fdt;
+	int offset;
+
+	offset = fdt_txn_out_nodes_(o, 0, INT_MAX);
+	if (offset < 0)
+		return offset;
+
+	fdt_txn_out_(o, FDT_TXN_COPY, fdt_off_dt_struct(fdt) + offset,
+		     fdt_size_dt_struct(fdt) - offset);
+	return 0;
+}
+
+/* Emit the whole result, noting where its blocks start */
+static int fdt_txn_out_all_(struct fdt_txn_out *o, int *struct_size,
+			    int *strings_off)
+{
+	const struct fdt_txn *txn = o->txn;
+	const void *fdt = txn->fdt;
+	int struct_off = fdt_off_dt_struct(fdt);
+	int struct_end = struct_off + fdt_size_dt_struct(fdt);
+	const struct fdt_txn_string *e;
+	int r, err;
+
+	fdt_txn_out_(o, FDT_TXN_COPY, 0, struct_off);
+
+	err = fdt_txn_out_struct_(o);
+	if (err)
+		return err;
+	*struct_size = o->pos - struct_off;
+
+	fdt_txn_out_(o, FDT_TXN_COPY, struct_end,
+		     fdt_off_dt_strings(fdt) - struct_end);
+	*strings_off = o->pos;
+
+	fdt_txn_out_(o, FDT_TXN_COPY, fdt_off_dt_strings(fdt),
+		     fdt_size_dt_strings(fdt));
+	for (r = txn->strings; r >= 0; r = e->next) {
+		e = fdt_txn_at_(txn, r);
+		fdt_txn_out_(o, FDT_TXN_MEM, e->str, e->len);
+	}
+
+	return o->err;
+}
+
+/*
+ * Play back the pieces of an in-place commit. Pieces of the base
+ * moving down are moved in order, and those moving up in reverse
+ * order, so none overwrites base data still to be moved. New data
+ * goes in last.
+ */
+static void fdt_txn_out_play_(const struct fdt_txn_out *o, int first)
+{
+	const struct fdt_txn *txn = o->txn;
+	const struct fdt_txn_piece *piece;
+	char *fdt = o->buf;
+	int r;
+
+	for (r = first; r < o->plan; r += sizeof(*piece)) {
+		piece = fdt_txn_at_(txn, r);
+		if ((piece->kind == FDT_TXN_COPY) && (piece->dest < piece->src))
+			memmove(fdt + piece->dest, fdt + piece->src,
+				piece->len);
+	}
+
+	for (r = o->plan - sizeof(*piece); r >= first; r -= sizeof(*piece)) {
+		piece = fdt_txn_at_(txn, r);
+		if ((piece->kind == FDT_TXN_COPY) && (piece->dest > piece->src))
+			memmove(fdt + piece->dest, fdt + piece->src,
+				piece->len);
+	}
+
+	for (r = first; r < o->plan; r += sizeof(*piece)) {
+		piece = fdt_txn_at_(txn, r);
+		if (piece->kind == FDT_TXN_MEM)
+			memcpy(fdt + piece->dest, fdt_txn_at_(txn, piece->src),
+			       piece->len);
+		else if (piece->kind == FDT_TXN_WORD)
+			*(fdt32_t *)(fdt + piece->dest) =
+				cpu_to_fdt32(piece->src);
+		else if (piece->kind == FDT_TXN_ZERO)
+			memset(fdt + piece->dest, 0, piece->len);
+	}
+}
+
+int fdt_txn_size(const struct fdt_txn *txn)
+{
+	struct fdt_txn_out o;
+	int struct_size, strings_off, err;
+
+	memset(&o, 0, sizeof(o));
+	o.txn = txn;
+	o.plan = o.last = -1;
+
+	err = fdt_txn_out_all_(&o, &struct_size, &strings_off);
+	if (err)
+		return err;
+
+	return o.pos;
+}
+
+/*
+ * Size of a node in the edited tree, with its subnodes: the new node
+ * recorded at @r, or the base node at @nodeoffset ending at @end.
+ */
+static int fdt_txn_node_size_(const struct fdt_txn *txn, int r,
+			      int nodeoffset, int end)
+{
+	struct fdt_txn_out o;
+	int err;
+
+	memset(&o, 0, sizeof(o));
+	o.txn = txn;
+	o.plan = o.last = -1;
+
+	if (r >= 0) {
+		fdt_txn_out_new_nodes_(&o, r, false);
+	} else {
+		err = fdt_txn_out_nodes_(&o, nodeoffset, end);
+		if (err < 0)
+			return err;
+	}
+
+	return o.pos;
+}
+
+int fdt_txn_commit(struct fdt_txn *txn, void *buf, int bufsize)
+{
+	const char *fdt = txn->fdt;
+	int strings_size = fdt_size_dt_strings(fdt) + txn->strsize;
+	struct fdt_txn_out o;
+	int struct_size, strings_off, err;
+
+	if (bufsize < 0)
+		return -FDT_ERR_NOSPACE;
+	if ((buf != fdt) && ((char *)buf < (fdt + fdt_totalsize(fdt)))
+	    && (fdt < ((char *)buf + bufsize)))
+		return -FDT_ERR_BADLAYOUT;
+
+	memset(&o, 0, sizeof(o));
+	o.txn = txn;
+	o.buf = buf;
+	o.bufsize = bufsize;
+	o.plan = (buf == fdt) ? txn->top : -1;
+	o.last = -1;
+
+	err = fdt_txn_out_all_(&o, &struct_size, &strings_off);
+	if (err)
+		return err;
+	if (o.pos > bufsize)
+		return -FDT_ERR_NOSPACE;
+
+	if (o.plan >= 0)
+		fdt_txn_out_play_(&o, txn->top);
+
+	fdt_set_totalsize(buf, bufsize);
+	fdt_set_size_dt_struct(buf, struct_size);
+	fdt_set_off_dt_strings(buf, strings_off);
+	fdt_set_size_dt_strings(buf, strings_size);
+	if (!can_assume(LATEST) && txn->edited && (fdt_version(buf) > 17))
+		fdt_set_version(buf, 17);
+
+	fdt_index_rebuild_(buf);
+	return 0;
+}
+
+/**********************************************************************/
+/* Scripts                                                            */
+/**********************************************************************/
+
+/*
+ * A script is the plan of an in-place commit, saved so that it can be
+ * played back on another copy of the base without the transaction.
+ * Tags and padding are turned into bytes, and runs of new bytes stored
+ * after the pieces, so that a piece either moves part of the base or
+ * copies bytes from the script.
+ */
+struct fdt_txn_script {
+	fdt32_t size;		/* of the result, up to the end of strings */
+	fdt32_t size_dt_struct;
+	fdt32_t off_dt_strings;
+	fdt32_t size_dt_strings;
+	fdt32_t version;
+	fdt32_t count;		/* of pieces */
+	fdt32_t datalen;	/* of new bytes */
+};
+
+struct fdt_txn_script_piece {
+	fdt32_t kind;		/* FDT_TXN_COPY or FDT_TXN_MEM */
+	fdt32_t dest;
+	fdt32_t src;		/* in the base, or in the new bytes */
+	fdt32_t len;
+};
+
+static uint64_t fdt_fingerprint_bytes_(uint64_t h, const void *p, int len)
+{
+	const unsigned char *b = p;
+
+	while (len-- > 0) {
+		h ^= *b++;
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+uint64_t fdt_fingerprint_buf_(const void *buf, int len)
+{
+	return fdt_fingerprint_bytes_(14695981039346656037ULL, buf, len);
+}
+
+uint64_t fdt_fingerprint_(const void *fdt)
+{
+	const char *p = fdt;
+	int end = fdt_off_dt_strings(fdt) + fdt_size_dt_strings(fdt);
+	uint64_t h;
+
+	if ((int)(fdt_off_dt_struct(fdt) + fdt_size_dt_struct(fdt)) > end)
+		end = fdt_off_dt_struct(fdt) + fdt_size_dt_struct(fdt);
+
+	/*
+	 * The totalsize, second in the header, only says how much free
+	 * space follows the blocks: leave it out.
+	 */
+	h = fdt_fingerprint_buf_(p, FDT_TAGSIZE);
+	return fdt_fingerprint_bytes_(h, p + 2 * FDT_TAGSIZE,
+				      end - 2 * FDT_TAGSIZE);
+}
+
+int fdt_txn_script_(struct fdt_txn *txn, void *script, int len)
+{
+	const char *fdt = txn->fdt;
+	struct fdt_txn_script *s = script;
+	struct fdt_txn_script_piece *pieces = (void *)(s + 1), *sp = NULL;
+	const struct fdt_txn_piece *piece;
+	struct fdt_txn_out o;
+	int struct_size, strings_off, count = 0, datalen = 0, total;
+	int version = fdt_version(fdt);
+	int r, err;
+	char *data;
+
+	if ((uintptr_t)script & (FDT_TAGSIZE - 1))
+		return -FDT_ERR_ALIGNMENT;
+
+	memset(&o, 0, sizeof(o));
+	o.txn = txn;
+	o.plan = txn->top;
+	o.last = -1;
+
+	err = fdt_txn_out_all_(&o, &struct_size, &strings_off);
+	if (err)
+		return err;
+
+	/* The pieces run on from each other, so new bytes merge in runs */
+	for (r = txn->top; r < o.plan; r += sizeof(*piece)) {
+		piece = fdt_txn_at_(txn, r);
+		if (piece->kind != FDT_TXN_COPY) {
+			if ((r == txn->top) || (piece[-1].kind == FDT_TXN_COPY))
+				count++;
+			datalen += piece->len;
+		} else {
+			count++;
+		}
+	}
+
+	total = sizeof(*s) + count * sizeof(*sp) + FDT_TAGALIGN(datalen);
+	if ((len < 0) || (total > len))
+		return -FDT_ERR_NOSPACE;
+
+	data = (char *)(pieces + count);
+	datalen = 0;
+	for (r = txn->top; r < o.plan; r += sizeof(*piece)) {
+		piece = fdt_txn_at_(txn, r);
+		if (piece->kind == FDT_TXN_COPY) {
+			sp = sp ? sp + 1 : pieces;
+			sp->kind = cpu_to_fdt32(FDT_TXN_COPY);
+			sp->dest = cpu_to_fdt32(piece->dest);
+			sp->src = cpu_to_fdt32(piece->src);
+			sp->len = cpu_to_fdt32(piece->len);
+			continue;
+		}
+
+		if ((r == txn->top) || (piece[-1].kind == FDT_TXN_COPY)) {
+			sp = sp ? sp + 1 : pieces;
+			sp->kind = cpu_to_fdt32(FDT_TXN_MEM);
+			sp->dest = cpu_to_fdt32(piece->dest);
+			sp->src = cpu_to_fdt32(datalen);
+			sp->len = 0;
+		}
+		sp->len = cpu_to_fdt32(fdt32_to_cpu(sp->len) + piece->len);
+
+		if (piece->kind == FDT_TXN_MEM)
+			memcpy(data + datalen, fdt_txn_at_(txn, piece->src),
+			       piece->len);
+		else if (piece->kind == FDT_TXN_WORD)
+			fdt32_st(data + datalen, piece->src);
+		else
+			memset(data + datalen, 0, piece->len);
+		datalen += piece->len;
+	}
+	memset(data + datalen, 0, FDT_TAGALIGN(datalen) - datalen);
+
+	if (!can_assume(LATEST) && txn->edited && (version > 17))
+		version = 17;
+
+	s->size = cpu_to_fdt32(o.pos);
+	s->size_dt_struct = cpu_to_fdt32(struct_size);
+	s->off_dt_strings = cpu_to_fdt32(strings_off);
+	s->size_dt_strings = cpu_to_fdt32(fdt_size_dt_strings(fdt)
+					  + txn->strsize);
+	s->version = cpu_to_fdt32(version);
+	s->count = cpu_to_fdt32(count);
+	s->datalen = cpu_to_fdt32(datalen);
+
+	return total;
+}
+
+/* Each piece is checked before anything is written */
+static int fdt_txn_script_check_(const void *fdt, const void *script,
+				 int len)
+{
+	const struct fdt_txn_script *s = script;
+	const struct fdt_txn_script_piece *sp = (const void *)(s + 1);
+	uint32_t size, datalen, count, end, dest, src, plen, i;
+	uint32_t version, off;
+
+	if ((uintptr_t)script & (FDT_TAGSIZE - 1))
+		return -FDT_ERR_ALIGNMENT;
+	if ((len < 0) || ((unsigned int)len < sizeof(*s)))
+		return -FDT_ERR_TRUNCATED;
+
+	size = fdt32_to_cpu(s->size);
+	count = fdt32_to_cpu(s->count);
+	datalen = fdt32_to_cpu(s->datalen);
+	if ((count > ((len - sizeof(*s)) / sizeof(*sp)))
+	    || (datalen > (len - sizeof(*s) - count * sizeof(*sp))))
+		return -FDT_ERR_TRUNCATED;
+	if (size > fdt_totalsize(fdt))
+		return -FDT_ERR_NOSPACE;
+
+	/* The header is written as it is: the blocks must fit together */
+	version = fdt32_to_cpu(s->version);
+	if ((version < FDT_FIRST_SUPPORTED_VERSION)
+	    || (version < fdt_last_comp_version(fdt))
+	    || (version > fdt_version(fdt)))
+		return -FDT_ERR_BADVERSION;
+	off = fdt32_to_cpu(s->off_dt_strings);
+	if ((off > size)
+	    || (fdt32_to_cpu(s->size_dt_strings) != (size - off))
+	    || (fdt_off_dt_struct(fdt) > off)
+	    || (fdt32_to_cpu(s->size_dt_struct)
+		> (off - fdt_off_dt_struct(fdt))))
+		return -FDT_ERR_BADVALUE;
+
+	end = fdt_off_dt_strings(fdt) + fdt_size_dt_strings(fdt);
+	for (i = 0; i < count; i++) {
+		dest = fdt32_to_cpu(sp[i].dest);
+		src = fdt32_to_cpu(sp[i].src);
+		plen = fdt32_to_cpu(sp[i].len);
+		if ((dest > size) || (plen > (size - dest)))
+			return -FDT_ERR_BADVALUE;
+		if (fdt32_to_cpu(sp[i].kind) == FDT_TXN_COPY) {
+			if ((src > end) || (plen > (end - src)))
+				return -FDT_ERR_BADVALUE;
+		} else if ((fdt32_to_cpu(sp[i].kind) != FDT_TXN_MEM)
+			   || (src > datalen) || (plen > (datalen - src))) {
+			return -FDT_ERR_BADVALUE;
+		}
+	}
+
+	return 0;
+}
+
+/* As fdt_txn_out_play_(), moving the base first */
+int fdt_txn_script_play_(void *fdt, const void *script, int len)
+{
+	const struct fdt_txn_script *s = script;
+	const struct fdt_txn_script_piece *sp = (const void *)(s + 1);
+	const char *data;
+	char *p = fdt;
+	int count, i, err;
+
+	err = fdt_txn_script_check_(fdt, script, len);
+	if (err)
+		return err;
+
+	count = fdt32_to_cpu(s->count);
+	data = (const char *)(sp + count);
+
+	for (i = 0; i < count; i++)
+		if ((fdt32_to_cpu(sp[i].kind) == FDT_TXN_COPY)
+		    && (fdt32_to_cpu(sp[i].dest) < fdt32_to_cpu(sp[i].src)))
+			memmove(p + fdt32_to_cpu(sp[i].dest),
+				p + fdt32_to_cpu(sp[i].src),
+				fdt32_to_cpu(sp[i].len));
+
+	for (i = count - 1; i >= 0; i--)
+		if ((fdt32_to_cpu(sp[i].kind) == FDT_TXN_COPY)
+		    && (fdt32_to_cpu(sp[i].dest) > fdt32_to_cpu(sp[i].src)))
+			memmove(p + fdt32_to_cpu(sp[i].dest),
+				p + fdt32_to_cpu(sp[i].src),
+				fdt32_to_cpu(sp[i].len));
+
+	for (i = 0; i < count; i++)
+		if (fdt32_to_cpu(sp[i].kind) == FDT_TXN_MEM)
+			memcpy(p + fdt32_to_cpu(sp[i].dest),
+			       data + fdt32_to_cpu(sp[i].src),
+			       fdt32_to_cpu(sp[i].len));
+
+	fdt_set_size_dt_struct(fdt, fdt32_to_cpu(s->size_dt_struct));
+	fdt_set_off_dt_strings(fdt, fdt32_to_cpu(s->off_dt_strings));
+	fdt_set_size_dt_strings(fdt, fdt32_to_cpu(s->size_dt_strings));
+	fdt_set_version(fdt, fdt32_to_cpu(s->version));
+
+	fdt_index_rebuild_(fdt);
+	return 0;
+}
@@ -27,6 +27,9 @@ int fdt_setprop_inplace_namelen_partial(void *fdt, int nodeoffset,
 		return -FDT_ERR_NOSPACE;
 
 	memcpy((char *)propval + idx, val, len);
+
+	fdt_index_prop_changed_(fdt, nodeoffset, name, namelen,
+				propval, proplen);
 	return 0;
 }
 
@@ -67,12 +70,17 @@ int fdt_nop_property(void *fdt, int nodeoffset, const char *name)
 
 	fdt_nop_region_(prop, len + sizeof(*prop));
 
+	fdt_index_prop_changed_(fdt, nodeoffset, name, strlen(name), NULL, -1);
 	return 0;
 }
 
 int fdt_node_end_offset_(void *fdt, int offset)
 {
-	int depth = 0;
+	struct fdt_index *idx = fdt_index_get_(fdt);
+	int depth = 0, i;
+
+	if (idx && ((i = fdt_index_node_find_(idx, offset)) >= 0))
+		return idx->nodes[i].end;
 
 	while ((offset >= 0) && (depth >= 0))
 		offset = fdt_next_node(fdt, offset, &depth);
@@ -90,5 +98,9 @@ int fdt_nop_node(void *fdt, int nodeoffset)
 
 	fdt_nop_region_(fdt_offset_ptr_w(fdt, nodeoffset, 0),
 			endoffset - nodeoffset);
+
+	/* Nodes in the region are gone, though nothing moved */
+	fdt_index_splice_(fdt, nodeoffset, endoffset - nodeoffset,
+			  endoffset - nodeoffset);
 	return 0;
 }
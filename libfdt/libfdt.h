@@ -366,6 +366,43 @@ const char *fdt_get_string(const void *fdt, int stroffset, int *lenp);
  */
 const char *fdt_string(const void *fdt, int stroffset);
 
+/**
+ * fdt_intern_namelen - find the offset of a name in the strings block
+ * @fdt: pointer to the device tree blob
+ * @name: name to look up
+ * @namelen: number of characters of name to consider
+ *
+ * fdt_intern_namelen() finds the first place @name occurs in the
+ * strings block of @fdt, which is the offset libfdt and dtc store in
+ * every property with that name. Properties can then be looked up by
+ * that offset with fdt_getprop_by_nameoff(), comparing integers rather
+ * than strings. The offset stays valid as the tree is edited, since
+ * libfdt only ever appends to the strings block, but a name which is
+ * not found may be added later.
+ *
+ * This scans the strings block, unless an index with a strings table
+ * is attached (see fdt_index_strings()).
+ *
+ * returns:
+ *	the offset of the name (>=0), on success
+ *	-FDT_ERR_NOTFOUND, no property of the tree can have that name
+ *	-FDT_ERR_BADSTATE, @fdt is still being created with fdt_create()
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_intern_namelen(const void *fdt, const char *name, int namelen);
+
+/**
+ * fdt_intern - find the offset of a name in the strings block
+ * @fdt: pointer to the device tree blob
+ * @name: name to look up
+ *
+ * Identical to fdt_intern_namelen(), with the length of @name taken
+ * from its terminating NUL.
+ */
+int fdt_intern(const void *fdt, const char *name);
+
 /**
  * fdt_find_max_phandle - find and return the highest phandle in a tree
  * @fdt: pointer to the device tree blob
@@ -781,6 +818,56 @@ static inline void *fdt_getprop_namelen_w(void *fdt, int nodeoffset,
 }
 #endif
 
+/**
+ * fdt_get_property_by_nameoff - find a property by the offset of its name
+ * @fdt: pointer to the device tree blob
+ * @nodeoffset: offset of the node whose property to find
+ * @nameoff: offset of the name in the strings block, from fdt_intern()
+ * @lenp: pointer to an integer variable (will be overwritten) or NULL
+ *
+ * Identical to fdt_get_property(), but finds the first property of the
+ * node whose name is stored at @nameoff, comparing only the offsets.
+ * For blobs written by libfdt or dtc, which store every occurrence of
+ * a name as the same offset, this finds the same property as looking
+ * up the name itself. In other blobs, properties naming a second copy
+ * of the string are not found.
+ *
+ * Note that this code only works on device tree versions >= 16.
+ *
+ * returns:
+ *	pointer to the structure representing the property
+ *		if lenp is non-NULL, *lenp contains the length of the property
+ *		value (>=0)
+ *	NULL, on error
+ *		if lenp is non-NULL, *lenp contains an error code (<0):
+ *		-FDT_ERR_NOTFOUND, node does not have a property of that name
+ *		-FDT_ERR_BADOFFSET, nodeoffset did not point to FDT_BEGIN_NODE
+ *		-FDT_ERR_BADMAGIC,
+ *		-FDT_ERR_BADVERSION,
+ *		-FDT_ERR_BADSTATE,
+ *		-FDT_ERR_BADSTRUCTURE,
+ *		-FDT_ERR_TRUNCATED, standard meanings
+ */
+const struct fdt_property *fdt_get_property_by_nameoff(const void *fdt,
+						      int nodeoffset,
+						      int nameoff, int *lenp);
+
+/**
+ * fdt_getprop_by_nameoff - get a property value by the offset of its name
+ * @fdt: pointer to the device tree blob
+ * @nodeoffset: offset of the node whose property to find
+ * @nameoff: offset of the name in the strings block, from fdt_intern()
+ * @lenp: pointer to an integer variable (will be overwritten) or NULL
+ *
+ * Identical to fdt_getprop(), but finds the property as
+ * fdt_get_property_by_nameoff() does.
+ *
+ * returns:
+ *	pointer to the property's value, or NULL on error
+ */
+const void *fdt_getprop_by_nameoff(const void *fdt, int nodeoffset,
+				   int nameoff, int *lenp);
+
 /**
  * fdt_getprop - retrieve the value of a given property
  * @fdt: pointer to the device tree blob
@@ -875,6 +962,9 @@ const char *fdt_get_alias(const void *fdt, const char *name);
  * NOTE: This function is expensive, as it must scan the device tree
  * structure from the start to nodeoffset.
  *
+ * On error, the contents of buf are unspecified; they may hold part
+ * of the path.
+ *
  * returns:
  *	0, on success
  *		buf contains the absolute path of the node at
@@ -1008,6 +1098,34 @@ int fdt_node_offset_by_prop_value(const void *fdt, int startoffset,
 				  const char *propname,
 				  const void *propval, int proplen);
 
+/**
+ * fdt_node_offsets_by_prop_value - find all nodes with a given property value
+ * @fdt: pointer to the device tree blob
+ * @propname: property name to check
+ * @propval: property value to search for
+ * @proplen: length of the value in propval
+ * @offsets: array receiving the offsets of the nodes found
+ * @count: number of entries in @offsets
+ *
+ * fdt_node_offsets_by_prop_value() finds the same nodes as iterating
+ * with fdt_node_offset_by_prop_value() from -1, and stores the offsets
+ * of the first @count of them, in tree order, in @offsets. With an
+ * index attached holding a table for @propname (see
+ * fdt_index_prop_values()), this takes time proportional to the
+ * number of nodes found.
+ *
+ * returns:
+ *	the number of nodes found (>= 0), which may be larger than
+ *		@count, on success
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE, standard meanings
+ */
+int fdt_node_offsets_by_prop_value(const void *fdt, const char *propname,
+				   const void *propval, int proplen,
+				   int *offsets, int count);
+
 /**
  * fdt_node_offset_by_phandle - find the node with a given phandle
  * @fdt: pointer to the device tree blob
@@ -1090,6 +1208,33 @@ int fdt_node_check_compatible(const void *fdt, int nodeoffset,
 int fdt_node_offset_by_compatible(const void *fdt, int startoffset,
 				  const char *compatible);
 
+/**
+ * fdt_for_each_compatible_node - iterate over nodes compatible with a string
+ * @node:	node offset (int, lvalue)
+ * @fdt:	FDT blob (const void *)
+ * @compatible:	string to match (const char *)
+ *
+ * This is actually a wrapper around a for loop and would be used like so:
+ *
+ *	fdt_for_each_compatible_node(node, fdt, compatible) {
+ *		Use node
+ *		...
+ *	}
+ *
+ *	if ((node < 0) && (node != -FDT_ERR_NOTFOUND)) {
+ *		Error handling
+ *	}
+ *
+ * The nodes are visited in tree order, see
+ * fdt_node_offset_by_compatible(). With an index holding a compatible
+ * table attached (see fdt_index_compatibles()), each step takes
+ * constant time.
+ */
+#define fdt_for_each_compatible_node(node, fdt, compatible)		\
+	for (node = fdt_node_offset_by_compatible(fdt, -1, compatible);	\
+	     node >= 0;							\
+	     node = fdt_node_offset_by_compatible(fdt, node, compatible))
+
 /**
  * fdt_stringlist_contains - check a string list property for a string
  * @strlist: Property containing a list of strings to check
@@ -1430,7 +1575,8 @@ int fdt_nop_node(void *fdt, int nodeoffset);
 #define FDT_CREATE_FLAG_NO_NAME_DEDUP 0x1
 	/* FDT_CREATE_FLAG_NO_NAME_DEDUP: Do not try to de-duplicate property
 	 * names in the fdt. This can result in faster creation times, but
-	 * a larger fdt. */
+	 * a larger fdt. Attaching a strings table (fdt_index_strings())
+	 * makes de-duplication cheap instead. */
 
 #define FDT_CREATE_FLAGS_ALL	(FDT_CREATE_FLAG_NO_NAME_DEDUP)
 
@@ -2096,6 +2242,19 @@ int fdt_del_node(void *fdt, int nodeoffset);
  * Expect the base device tree to be modified, even if the function
  * returns an error.
  *
+ * Each fragment is merged into its target with a single move of the
+ * rest of the blob when the blob has spare room for a copy of the
+ * merged target subtree, and property by property otherwise. The
+ * result is the same either way.
+ *
+ * The target of each fragment is resolved once and recorded for the
+ * update of the symbols. Having no memory to record them in,
+ * fdt_overlay_apply() only records the targets of the first 16
+ * fragments; those of the others are resolved again for each symbol
+ * they hold. The variants which are given memory record them all
+ * there, which takes up to 16 bytes per node at the root of the
+ * overlay.
+ *
  * returns:
  *	0, on success
  *	-FDT_ERR_NOSPACE, there's not enough space in the base device tree
@@ -2116,6 +2275,1186 @@ int fdt_del_node(void *fdt, int nodeoffset);
  */
 int fdt_overlay_apply(void *fdt, void *fdto);
 
+/**
+ * fdt_overlay_apply_parallel - Applies a DT overlay, merging at once
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ * @buf: scratch memory
+ * @bufsize: size of the memory at @buf
+ * @threads: number of threads to merge the fragments with
+ *
+ * fdt_overlay_apply_parallel() applies the overlay exactly as
+ * fdt_overlay_apply() does, with the same resulting blob, but when
+ * the targets of the fragments are all found in the base before
+ * anything is merged, it builds each merged target separately in @buf
+ * and then puts them all in place with a single move of the rest of
+ * the blob. Fragments whose targets lie within the subtree of another
+ * target are merged, in order, into a copy of that subtree, which is
+ * then built as a single target.
+ *
+ * When libfdt is built with FDT_THREADS defined, the merged targets
+ * are built by up to @threads threads at once, using pthreads.
+ * Otherwise they are built one after the other by the calling thread.
+ * The index attached to @fdt, if any, is detached while they run and
+ * attached again afterwards; an index attached to @fdto is only read.
+ * As the index registry is global and not thread safe, no other
+ * thread may attach or detach an index, or edit a blob with one
+ * attached, during the call.
+ *
+ * @buf needs room for a copy of the merged structure block, plus
+ * about a hundred bytes for each fragment, plus, for each subtree
+ * shared by several fragments, a copy of the strings block and three
+ * times the subtree and the fragments merged into it. If it is too
+ * small, the fragments are merged one after the other as by
+ * fdt_overlay_apply(). @buf must not overlap either blob. The start
+ * of @buf records the targets of the fragments, see fdt_overlay_apply(),
+ * and the __overlay__ node of each. Before the merge, the rest of @buf
+ * also holds a path cache over the overlay while its phandles are
+ * fixed up, as the transaction memory does for fdt_overlay_apply_txn().
+ *
+ * returns:
+ *	as fdt_overlay_apply()
+ */
+int fdt_overlay_apply_parallel(void *fdt, void *fdto, void *buf,
+			       int bufsize, int threads);
+
+/**********************************************************************/
+/* Lookup indexes                                                     */
+/**********************************************************************/
+
+/*
+ * An index is a set of side tables describing a single device tree
+ * blob. It lives entirely in memory supplied by the caller; libfdt
+ * never allocates. Once attached with fdt_index_attach(), the regular
+ * read-only functions consult the index transparently, and the
+ * read-write functions keep it in step with the edits they make.
+ *
+ * Changes made to the blob behind libfdt's back (e.g. through the
+ * pointer returned by fdt_getprop_w()) are not tracked. The members of
+ * struct fdt_index are private to libfdt.
+ */
+#define FDT_INDEX_MAX_ATTACHED	8
+	/* Number of blobs which can have an index attached at once */
+
+struct fdt_index_phandle;
+struct fdt_index_node;
+struct fdt_index_path;
+struct fdt_index_string;
+struct fdt_index_symbol;
+struct fdt_index_prop;
+struct fdt_index_value;
+struct fdt_index_value_node;
+
+#define FDT_INDEX_MAX_VALUES	4
+	/* Number of properties which can have their values indexed */
+
+struct fdt_index_values {
+	const char *name;
+	int namelen;
+	int split;	/* each string of the list is a value */
+	int *slots;
+	struct fdt_index_value *ents;
+	struct fdt_index_value_node *nodes;
+	int mask;
+	int count;
+	int max;
+	int node_count;
+	int node_max;
+	int stale;
+};
+
+struct fdt_index {
+	const void *fdt;
+
+	/* phandle -> node offset table, see fdt_index_phandles() */
+	int *ph_slots;
+	struct fdt_index_phandle *ph_ents;
+	int ph_mask;
+	int ph_count;
+	int ph_max;
+	int ph_complete;
+	uint32_t ph_highest;
+	int ph_highest_known;
+
+	/* node table in offset order, see fdt_index_nodes() */
+	struct fdt_index_node *nodes;
+	int node_count;
+	int node_max;
+
+	/* full path -> node offset cache, see fdt_index_paths() */
+	int *path_slots;
+	struct fdt_index_path *path_ents;
+	char *path_strs;
+	int path_mask;
+	int path_count;
+	int path_max;
+	int path_strsize;
+	int path_strused;
+
+	/* node offset -> path cache, see fdt_index_node_paths() */
+	char *npath_strs;
+	int npath_strsize;
+	int npath_strused;
+
+	/* strings block lookup table, see fdt_index_strings() */
+	int *str_slots;
+	struct fdt_index_string *str_ents;
+	int str_mask;
+	int str_count;
+	int str_max;
+	int str_size;
+
+	/* /__symbols__ label lookup table, see fdt_index_symbols() */
+	int *sym_slots;
+	struct fdt_index_symbol *sym_ents;
+	int sym_mask;
+	int sym_count;
+	int sym_max;
+	int sym_node;
+	int sym_stale;
+
+	/* per-node property name tables, see fdt_index_props() */
+	struct fdt_index_prop *props;
+	int prop_count;
+	int prop_max;
+
+	/* compatible string -> nodes table, see fdt_index_compatibles() */
+	struct fdt_index_values compat;
+
+	/* property value -> nodes tables, see fdt_index_prop_values() */
+	struct fdt_index_values values[FDT_INDEX_MAX_VALUES];
+};
+
+/**
+ * fdt_index_init - prepare an empty index for a device tree blob
+ * @idx: index to initialise
+ * @fdt: pointer to the device tree blob the index describes
+ *
+ * fdt_index_init() resets @idx so that it describes @fdt but holds
+ * no tables yet. Tables are added with the fdt_index_*() builders
+ * below. The index refers to @fdt by address, so it has to be
+ * rebuilt if the blob is moved elsewhere in memory (fdt_resize() is
+ * the exception, it carries the index along).
+ *
+ * @fdt may also be a blob under construction with fdt_create(), to
+ * which only a strings table can be added, see fdt_index_strings().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE, standard meanings
+ */
+int fdt_index_init(struct fdt_index *idx, const void *fdt);
+
+/**
+ * fdt_index_phandles - build the phandle table of an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the table (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_phandles() records the node carrying every phandle in the
+ * tree, in a single pass over the structure block. With the index
+ * attached, fdt_node_offset_by_phandle() becomes a hash lookup
+ * instead of a walk over the whole tree. The table holds up to
+ * @bufsize / 16 phandles, rounded down to a power of two.
+ *
+ * The table also keeps the highest phandle once fdt_find_max_phandle()
+ * has walked the tree for it, raising it as phandles are set. Later
+ * calls, and so fdt_generate_phandle() and fdt_overlay_apply(), only
+ * walk the tree again after the node holding it lost its phandle.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small for the phandles in the tree
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_phandles(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_nodes - build the node table of an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the table (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_nodes() records the offset, parent, depth and end offset
+ * of every node in the tree, in a single pass over the structure
+ * block. With the index attached, fdt_parent_offset(),
+ * fdt_node_depth() and fdt_supernode_atdepth_offset() no longer
+ * rescan the tree from the root, fdt_subnode_offset() and
+ * fdt_path_offset() step over each child's subtree instead of walking
+ * it, finding the end of a node no longer walks its subtree, and
+ * fdt_get_path() follows the parents of the node instead of scanning
+ * the tree up to it.
+ *
+ * Each node needs 32 bytes of @buf. Spare room lets the table follow
+ * nodes added later with fdt_add_subnode(); if it runs out, the table
+ * is dropped and libfdt falls back to scanning the tree.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small for the nodes in the tree
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_nodes(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_paths - set up the path cache of an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the cache (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_paths() sets up an initially empty cache mapping full
+ * paths, as passed to fdt_path_offset(), to node offsets. Every
+ * successful lookup of a path starting with '/' is remembered, so
+ * repeated lookups of the same string (such as the symbol paths looked
+ * up in the base by fdt_overlay_apply(), or the paths of the __fixups__
+ * looked up in the overlay, once per reference) no longer walk the
+ * tree. Aliases are not cached themselves, but the path they resolve
+ * to is.
+ *
+ * Half of @buf holds the table, which has room for @bufsize / 48
+ * paths rounded down to a power of two, and the other half the path
+ * strings. Once either is full, no new paths are added.
+ *
+ * The cache follows the edits made through libfdt: entries move with
+ * the node they describe, and are dropped when their node goes away
+ * or a new node could change how they resolve.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @bufsize is too small
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE, standard meanings
+ */
+int fdt_index_paths(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_node_paths - set up the node path cache of an index
+ * @idx: index with a node table, see fdt_index_nodes()
+ * @buf: memory to hold the cache
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_node_paths() sets up an initially empty cache of the
+ * paths returned by fdt_get_path(), by node. A repeated request for
+ * the path of a node copies it out of the cache instead of collecting
+ * the names of its parents again. Each path takes its length in @buf;
+ * once it is full, the cache is emptied and starts over.
+ *
+ * The cache follows the edits made through libfdt; renaming a node
+ * empties it. Since fdt_get_path() fills the cache, an index with a
+ * node path cache must not be used from several threads at once,
+ * even when they only look paths up.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @bufsize is negative
+ *	-FDT_ERR_BADSTATE, @idx has no node table
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION, standard meanings
+ */
+int fdt_index_node_paths(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_strings - build the strings table of an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the table (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_strings() hashes the contents of the strings block, so
+ * that adding a property no longer scans the whole block to find out
+ * whether its name is already there. The offsets chosen for property
+ * names, and hence the resulting blob, are exactly those libfdt
+ * produces without the table.
+ *
+ * A name may be shared with the tail of a longer one, so the table
+ * needs an entry for each byte of the strings block, and holds up to
+ * @bufsize / 16 of them, rounded down to a power of two. Names added
+ * through libfdt are added to the table; if it runs out of room, it is
+ * dropped and the strings block is scanned again.
+ *
+ * The table also works for a blob being built with the sequential
+ * write functions: set it up right after fdt_create_with_flags() and
+ * fdt_property() deduplicates names at about the cost of
+ * FDT_CREATE_FLAG_NO_NAME_DEDUP, with the same output as a scan. It
+ * stays valid through fdt_resize() and fdt_finish().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small for the strings block
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE, standard meanings
+ */
+int fdt_index_strings(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_symbols - build the symbols table of an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the table (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_symbols() hashes the labels of the /__symbols__ node, so
+ * that looking one up with fdt_getprop() no longer scans every
+ * property of the node. fdt_overlay_apply() looks up a label for each
+ * __fixups__ property of the overlay; together with a path cache (see
+ * fdt_index_paths()) resolving a fixup then takes constant time
+ * instead of time proportional to the number of symbols. The table
+ * holds up to @bufsize / 16 labels, rounded down to a power of two.
+ *
+ * The table follows the edits made through libfdt. Edits to the
+ * properties of /__symbols__, such as the symbols fdt_overlay_apply()
+ * adds, have it read the node again on the next lookup. If the labels
+ * no longer fit, the table is dropped.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small for the labels in the tree
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_symbols(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_props - add property name tables to an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the tables (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_props() has property lookups by name, such as
+ * fdt_getprop(), find the property through a table of the node's
+ * properties sorted by the offset of their name in the strings block.
+ * The name is looked up once in the strings table, then found among
+ * the node's properties by comparing integers, instead of comparing
+ * it with the name of every property of the node in turn.
+ *
+ * The tables are read lazily: the first lookup in a node records all
+ * its properties, using 8 bytes of @buf for each. When @buf is full,
+ * every node's table is forgotten and read again when next needed.
+ * Lookups thus write to the index, and an index with property tables
+ * must not be shared between threads. Adding, removing or resizing a
+ * property, or renaming its node, has the node's table read again.
+ *
+ * The index must hold a node table and a strings table, see
+ * fdt_index_nodes() and fdt_index_strings(). Without either, lookups
+ * fall back to scanning the node's properties.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @bufsize is negative
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADSTATE, the index has no node or strings table
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION, standard meanings
+ */
+int fdt_index_props(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_compatibles - build the compatible table of an index
+ * @idx: index initialised with fdt_index_init()
+ * @buf: memory to hold the table (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_compatibles() reads the "compatible" property of every
+ * node in a single pass over the tree, and records for each string
+ * the nodes listing it, in tree order. With the index attached,
+ * fdt_node_offset_by_compatible() looks the string up and returns the
+ * next node from its list instead of checking every node on the way:
+ * going through all the nodes compatible with a string, as
+ * fdt_for_each_compatible_node() does, takes time proportional to
+ * the number of nodes found rather than to the size of the tree.
+ *
+ * Half of @buf holds the distinct strings, up to @bufsize / 64 of
+ * them rounded down to a power of two; the other half holds 8 bytes
+ * for each string of each node.
+ *
+ * The table follows the edits made through libfdt which move nodes
+ * around. Edits to "compatible" properties, and removing nodes, have
+ * the tree read again on the next lookup, which thus writes to the
+ * index: an index with a compatible table must not be shared between
+ * threads. If the strings no longer fit, the table is dropped.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small for the strings in the tree
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_compatibles(struct fdt_index *idx, void *buf, int bufsize);
+
+/**
+ * fdt_index_prop_values - build a value table for a property of an index
+ * @idx: index initialised with fdt_index_init()
+ * @name: name of the property to index
+ * @buf: memory to hold the table (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_index_prop_values() reads property @name of every node in a
+ * single pass over the tree, and records for each of its values the
+ * nodes holding it, in tree order. With the index attached,
+ * fdt_node_offset_by_prop_value() for @name looks the value up and
+ * returns the next node from its list, and
+ * fdt_node_offsets_by_prop_value() collects them all in time
+ * proportional to their number.
+ *
+ * Up to FDT_INDEX_MAX_VALUES properties can be indexed this way;
+ * building the table of a property again replaces the previous one.
+ * A copy of @name is kept at the start of @buf. Half of the rest
+ * holds the distinct values, up to a 64th of it rounded down to a
+ * power of two; the other half holds 8 bytes for each node having
+ * the property.
+ *
+ * The table is maintained like the compatible table, see
+ * fdt_index_compatibles(): edits to property @name, and removing
+ * nodes, have the tree read again on the next lookup.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small for the values in the tree,
+ *		or FDT_INDEX_MAX_VALUES other properties are indexed
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_prop_values(struct fdt_index *idx, const char *name,
+			  void *buf, int bufsize);
+
+/**
+ * fdt_index_attach - make an index visible to libfdt
+ * @idx: index to attach
+ *
+ * fdt_index_attach() registers @idx for the blob it was initialised
+ * with, replacing any index previously attached to that blob. Only a
+ * small, fixed number of blobs (FDT_INDEX_MAX_ATTACHED) can have an
+ * index attached at the same time. The registry is not thread safe.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, too many indexes are attached already
+ */
+int fdt_index_attach(struct fdt_index *idx);
+
+/**
+ * fdt_index_detach - stop libfdt from using an index
+ * @idx: index to detach
+ *
+ * fdt_index_detach() unregisters @idx. Detaching an index which is
+ * not attached is harmless.
+ */
+void fdt_index_detach(struct fdt_index *idx);
+
+/**********************************************************************/
+/* Transactions                                                       */
+/**********************************************************************/
+
+/*
+ * A transaction records a batch of edits against a base blob without
+ * touching it, then writes the edited tree out in a single pass with
+ * fdt_txn_commit(). A series of edits made directly with the
+ * read-write functions moves the rest of the blob at each step; a
+ * transaction copies every byte once.
+ *
+ * The result is exactly the blob the read-write functions would
+ * produce by making the same edits, in the same order, on a copy of
+ * the base opened with a totalsize of the commit buffer's size: the
+ * same offsets, strings and padding.
+ *
+ * Edits and lookups use node offsets of the edited tree. Nodes of the
+ * base keep their offsets for the whole transaction, and new nodes get
+ * offsets past the end of the base structure block; these are only
+ * meaningful to the fdt_txn_*() functions. Offsets of deleted nodes
+ * become invalid. The members of struct fdt_txn are private to libfdt.
+ */
+struct fdt_txn {
+	const void *fdt;
+	char *buf;
+	int bufsize;
+	int *slots;
+	int mask;
+	int used;
+	int top;
+	int bottom;
+	int strings;
+	int last_string;
+	int strsize;
+	int deleted;
+	int phandles;
+	int edited;
+	int size;
+	int peak;
+};
+
+/**
+ * fdt_txn_init - start a transaction on a device tree blob
+ * @txn: transaction to initialise
+ * @fdt: pointer to the base device tree blob, which is only read
+ * @buf: memory to record the edits in (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_txn_init() starts an empty transaction against @fdt. Everything
+ * the transaction records, including copies of the new names and
+ * property values, lives in @buf, so the caller's buffers can be
+ * reused as soon as an edit returns. An eighth of @buf holds a hash
+ * table of the base nodes being edited. @buf must not overlap @fdt or
+ * the buffer given to fdt_txn_commit().
+ *
+ * @fdt must be acceptable to the read-write functions, e.g. opened
+ * with fdt_open_into(), and must not change while the transaction is
+ * open. An index attached to @fdt speeds up the lookups made by the
+ * transaction.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @bufsize is too small
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_init(struct fdt_txn *txn, const void *fdt, void *buf, int bufsize);
+
+/**
+ * fdt_txn_setprop - record a change of property value
+ * @txn: transaction
+ * @nodeoffset: offset of the node whose property to change
+ * @name: name of the property to change
+ * @val: pointer to data to set the property value to
+ * @len: length of the property value
+ *
+ * fdt_txn_setprop() is the transaction counterpart of fdt_setprop().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, the transaction memory is full
+ *	-FDT_ERR_BADOFFSET, nodeoffset is not a node of the edited tree
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_setprop(struct fdt_txn *txn, int nodeoffset, const char *name,
+		    const void *val, int len);
+
+/**
+ * fdt_txn_setprop_placeholder - record a property to be filled in
+ * @txn: transaction
+ * @nodeoffset: offset of the node whose property to change
+ * @name: name of the property to change
+ * @len: length of the property value
+ * @prop_data: return pointer to property data
+ *
+ * fdt_txn_setprop_placeholder() is the transaction counterpart of
+ * fdt_setprop_placeholder(). The returned pointer is into the
+ * transaction memory, and stays valid until the transaction ends.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, the transaction memory is full
+ *	-FDT_ERR_BADOFFSET, nodeoffset is not a node of the edited tree
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_setprop_placeholder(struct fdt_txn *txn, int nodeoffset,
+				const char *name, int len, void **prop_data);
+
+/**
+ * fdt_txn_delprop - record the removal of a property
+ * @txn: transaction
+ * @nodeoffset: offset of the node whose property to nop
+ * @name: name of the property to delete
+ *
+ * fdt_txn_delprop() is the transaction counterpart of fdt_delprop().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOTFOUND, node does not have the named property
+ *	-FDT_ERR_NOSPACE, the transaction memory is full
+ *	-FDT_ERR_BADOFFSET, nodeoffset is not a node of the edited tree
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_delprop(struct fdt_txn *txn, int nodeoffset, const char *name);
+
+/**
+ * fdt_txn_add_subnode_namelen - record the creation of a subnode
+ * @txn: transaction
+ * @parentoffset: offset of the parent node
+ * @name: name of the subnode to create
+ * @namelen: number of characters of name to consider
+ *
+ * Identical to fdt_txn_add_subnode(), but only examine the first
+ * namelen characters of name.
+ */
+int fdt_txn_add_subnode_namelen(struct fdt_txn *txn, int parentoffset,
+				const char *name, int namelen);
+
+/**
+ * fdt_txn_add_subnode - record the creation of a subnode
+ * @txn: transaction
+ * @parentoffset: offset of the parent node
+ * @name: name of the subnode to create
+ *
+ * fdt_txn_add_subnode() is the transaction counterpart of
+ * fdt_add_subnode().
+ *
+ * returns:
+ *	structure block offset of the new node in the edited tree, on success
+ *	-FDT_ERR_EXISTS, the parent already has a subnode of that name
+ *	-FDT_ERR_NOSPACE, the transaction memory is full
+ *	-FDT_ERR_BADOFFSET, parentoffset is not a node of the edited tree
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_add_subnode(struct fdt_txn *txn, int parentoffset,
+			const char *name);
+
+/**
+ * fdt_txn_del_node - record the removal of a node and its subnodes
+ * @txn: transaction
+ * @nodeoffset: offset of the node to delete
+ *
+ * fdt_txn_del_node() is the transaction counterpart of fdt_del_node().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, the transaction memory is full
+ *	-FDT_ERR_BADOFFSET, nodeoffset is not a node of the edited tree
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_del_node(struct fdt_txn *txn, int nodeoffset);
+
+/*
+ * Read-only access to the edited tree. These behave as the functions
+ * of the same name without the fdt_txn_ prefix would on the result of
+ * committing the transaction at that point, except that node offsets
+ * are those of the edited tree. Property values returned point into
+ * either the base blob or the transaction memory.
+ */
+const void *fdt_txn_getprop_namelen(const struct fdt_txn *txn,
+				    int nodeoffset, const char *name,
+				    int namelen, int *lenp);
+const void *fdt_txn_getprop(const struct fdt_txn *txn, int nodeoffset,
+			    const char *name, int *lenp);
+uint32_t fdt_txn_get_phandle(const struct fdt_txn *txn, int nodeoffset);
+const char *fdt_txn_get_name(const struct fdt_txn *txn, int nodeoffset,
+			     int *lenp);
+int fdt_txn_parent_offset(const struct fdt_txn *txn, int nodeoffset);
+int fdt_txn_subnode_offset_namelen(const struct fdt_txn *txn, int parentoffset,
+				   const char *name, int namelen);
+int fdt_txn_subnode_offset(const struct fdt_txn *txn, int parentoffset,
+			   const char *name);
+int fdt_txn_path_offset_namelen(const struct fdt_txn *txn, const char *path,
+				int namelen);
+int fdt_txn_path_offset(const struct fdt_txn *txn, const char *path);
+int fdt_txn_node_offset_by_phandle(const struct fdt_txn *txn,
+				   uint32_t phandle);
+int fdt_txn_find_max_phandle(const struct fdt_txn *txn, uint32_t *phandle);
+int fdt_txn_get_path(const struct fdt_txn *txn, int nodeoffset, char *buf,
+		     int buflen);
+
+/**
+ * fdt_txn_size - size of the result of a transaction
+ * @txn: transaction
+ *
+ * fdt_txn_size() returns the number of bytes the edited tree needs,
+ * that is the smallest buffer size fdt_txn_commit() accepts. It walks
+ * the base blob without writing anything.
+ *
+ * returns:
+ *	size in bytes, on success
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_size(const struct fdt_txn *txn);
+
+/**
+ * fdt_txn_commit - write out the edited tree
+ * @txn: transaction
+ * @buf: buffer to write the result to
+ * @bufsize: size of the buffer at @buf
+ *
+ * fdt_txn_commit() writes the base blob with all the recorded edits
+ * applied to @buf, in one pass, and sets its totalsize to @bufsize.
+ *
+ * @buf may be the base blob itself, provided it has @bufsize bytes of
+ * room. The edited tree is then built in place, which needs some
+ * transaction memory for the plan of the moves; the base is only
+ * touched once the result is known to fit. After such a commit the
+ * transaction is over. Otherwise @buf must not overlap the base blob,
+ * which stays as it was, and the transaction can go on.
+ *
+ * Any index attached to @buf is rebuilt for the new contents.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @bufsize is too small for the result, or
+ *		committing in place needs more transaction memory
+ *	-FDT_ERR_BADLAYOUT, @buf overlaps the base blob but is not the
+ *		same address
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_commit(struct fdt_txn *txn, void *buf, int bufsize);
+
+/**
+ * fdt_overlay_apply_txn - Records the application of a DT overlay
+ * @txn: transaction on the base device tree
+ * @fdto: pointer to the device tree overlay blob
+ *
+ * fdt_overlay_apply_txn() records in @txn the edits fdt_overlay_apply()
+ * would make to the base device tree, which itself is left alone. The
+ * merged tree is written out by fdt_txn_commit(); committing the
+ * transaction gives the same blob as fdt_overlay_apply() on a copy of
+ * the base opened with fdt_open_into().
+ *
+ * The overlay is modified as by fdt_overlay_apply(), and its magic is
+ * invalidated whether or not the call succeeds. On failure the
+ * transaction holds a partial application and should be abandoned.
+ *
+ * The targets of the fragments are recorded in the transaction memory,
+ * see fdt_overlay_apply(). Unless the overlay already has an index
+ * attached, the free part of the transaction memory also holds a path
+ * cache over the overlay while its phandles are fixed up, see
+ * fdt_index_paths(), so that the node of each __fixups__ path is only
+ * walked to once. The cache is attached for the duration, and is
+ * skipped when no slot is free for it.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, the transaction memory is full
+ *	-FDT_ERR_NOTFOUND, the overlay points to some nonexistent nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_apply_txn(struct fdt_txn *txn, void *fdto);
+
+/**
+ * fdt_overlay_apply_atomic - Applies a DT overlay, or leaves the base alone
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ * @buf: scratch memory for the transaction (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_overlay_apply_atomic() merges the overlay into the base device
+ * tree like fdt_overlay_apply(), with the same result on success, but
+ * either succeeds or leaves the base exactly as it was: there is no
+ * need to keep a copy of the base around in case the overlay turns
+ * out to be broken or too big.
+ *
+ * The application is recorded in a transaction held in @buf, see
+ * fdt_overlay_apply_txn(), and then committed in place within the
+ * totalsize of the base. The base is only written once the merged
+ * tree is known to fit. @buf must not overlap either blob; its size
+ * bounds the edits the overlay can make, a few times the size of the
+ * overlay being plenty for typical overlays.
+ *
+ * The overlay is modified as by fdt_overlay_apply(), and its magic is
+ * invalidated whether or not the call succeeds.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, there's not enough space in the base device
+ *		tree, or in @buf
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_NOTFOUND, the overlay points to some nonexistent nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_apply_atomic(void *fdt, void *fdto, void *buf, int bufsize);
+
+/**
+ * fdt_overlay_apply_size - Space needed to apply a DT overlay
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ * @buf: scratch memory (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_overlay_apply_size() works out, without modifying either blob,
+ * the smallest totalsize with which fdt_overlay_apply() succeeds on
+ * @fdt, so that the base can be packed and then opened with
+ * fdt_open_into() into a buffer of exactly that size. This covers the
+ * properties, subnodes and strings added by merging the fragments and
+ * the __symbols__ entries, as well as any point during the application
+ * where the tree is bigger than in the end. The same size is always
+ * enough for fdt_overlay_apply_atomic().
+ *
+ * @fdt must be acceptable to the read-write functions. The size is
+ * for its blocks laid out as they are, which is as fdt_open_into()
+ * leaves them.
+ *
+ * The overlay is copied to @buf, and the rest of @buf holds a
+ * transaction recording the application, see fdt_overlay_apply_txn().
+ * @buf must not overlap either blob.
+ *
+ * returns:
+ *	the size in bytes, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_NOTFOUND, the overlay points to some nonexistent nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_apply_size(const void *fdt, const void *fdto, void *buf,
+			   int bufsize);
+
+/* Problems reported by fdt_overlay_check() */
+#define FDT_OVERLAY_UNRESOLVED	1	/* label missing from the base */
+#define FDT_OVERLAY_NO_TARGET	2	/* fragment target not found */
+#define FDT_OVERLAY_OVERWRITE	3	/* base property set again */
+
+/*
+ * The findings of fdt_overlay_check(). @fn, if set, is called with
+ * @ctx for each problem as it is found:
+ *
+ *	FDT_OVERLAY_UNRESOLVED: @offset is the property in the overlay's
+ *		__fixups__ node, and @name the label the base has no
+ *		symbol for
+ *	FDT_OVERLAY_NO_TARGET: @offset is the fragment node in the
+ *		overlay, @name is NULL
+ *	FDT_OVERLAY_OVERWRITE: @offset is the node in the base, and
+ *		@name the property the overlay sets again
+ *
+ * A non-zero return from @fn stops the check, which then returns it.
+ */
+struct fdt_overlay_report {
+	int (*fn)(void *ctx, int kind, int offset, const char *name);
+	void *ctx;
+	int unresolved;		/* number of each kind of problem */
+	int missing;
+	int overwritten;
+	int delta;		/* change in the size the blob uses */
+	int size;		/* as fdt_overlay_apply_size() */
+};
+
+/**
+ * fdt_overlay_check - Checks what applying a DT overlay would do
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ * @buf: scratch memory (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ * @report: where to report the findings, with @fn and @ctx set
+ *
+ * fdt_overlay_check() goes through the __local_fixups__, __fixups__
+ * and fragments of the overlay as fdt_overlay_apply() would, without
+ * writing to or copying either blob. Each label missing from the
+ * symbols of the base, each fragment whose target can't be found and
+ * each base property which would be overwritten is reported, rather
+ * than stopping at the first problem.
+ *
+ * When every label and target is found, @report also receives the
+ * exact number of bytes the application adds to the blob, and the
+ * smallest totalsize it succeeds with. The edits are recorded in a
+ * transaction held in @buf, see fdt_overlay_apply_txn(); @buf must
+ * not overlap either blob.
+ *
+ * returns:
+ *	0, the overlay would apply
+ *	-FDT_ERR_NOTFOUND, a label or a target is missing; the first
+ *		error fdt_overlay_apply() would return otherwise
+ *	-FDT_ERR_NOSPACE, @buf is too small
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ *	the non-zero value returned by @report->fn, if any
+ */
+int fdt_overlay_check(const void *fdt, const void *fdto, void *buf,
+		      int bufsize, struct fdt_overlay_report *report);
+
+/**
+ * fdt_overlay_apply_many - Applies a series of DT overlays at once
+ * @fdt: pointer to the base device tree blob
+ * @fdtos: array of pointers to the device tree overlay blobs
+ * @count: number of overlays in @fdtos
+ * @buf: scratch memory for the transaction (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_overlay_apply_many() merges the overlays into the base device
+ * tree, with the same result as calling fdt_overlay_apply() on each of
+ * them in turn: each overlay's phandles are renumbered past those of
+ * the base and of the overlays before it, and its fixups are resolved
+ * against the symbols of the base and of the overlays before it.
+ *
+ * All the overlays are recorded in one transaction held in @buf, see
+ * fdt_overlay_apply_txn(), which is committed in place within the
+ * totalsize of the base once they have all been applied. The base
+ * tree is scanned for its highest phandle only once, and written and
+ * indexed only once. As with fdt_overlay_apply_atomic(), the base is
+ * left exactly as it was if any overlay fails to apply, or the result
+ * does not fit. @buf must not overlap any of the blobs.
+ *
+ * The overlays are modified as by fdt_overlay_apply(), and their magic
+ * invalidated, up to the first one which fails to apply; the later
+ * ones are left alone.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, there's not enough space in the base device
+ *		tree, or in @buf
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_NOTFOUND, an overlay points to some nonexistent nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_apply_many(void *fdt, void **fdtos, int count, void *buf,
+			   int bufsize);
+
+/*
+ * A changeset records the edits fdt_overlay_apply_changeset() makes to
+ * a base tree, so that fdt_overlay_revert() can undo them: the old
+ * value of each property overwritten, and each property and node
+ * added, including those under /__symbols__. A node added is recorded
+ * once, as removing it also removes everything merged below it. The
+ * members of struct fdt_changeset are private to libfdt.
+ */
+struct fdt_changeset {
+	char *buf;
+	int size;
+	int used;	/* records at the end of @buf, newest first */
+};
+
+/**
+ * fdt_changeset_init - start an empty changeset
+ * @cs: changeset to initialise
+ * @buf: memory for the records (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * The changeset lives entirely in @buf, which can be saved and handed
+ * to fdt_overlay_revert() later, as long as @cs is kept along with it.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_NOSPACE, @bufsize is negative
+ */
+int fdt_changeset_init(struct fdt_changeset *cs, void *buf, int bufsize);
+
+/**
+ * fdt_overlay_apply_changeset - Applies a DT overlay, recording its edits
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ * @cs: changeset to add the edits to, or NULL
+ *
+ * fdt_overlay_apply_changeset() applies the overlay in place exactly as
+ * fdt_overlay_apply() does, and records each edit made to the base in
+ * @cs as it goes. Several overlays can be recorded in one changeset.
+ *
+ * Each fragment is merged property by property, since the single move
+ * of fdt_overlay_apply() does not leave the old values behind. The
+ * free part of @cs records the targets of the fragments when there are
+ * more than fdt_overlay_apply() records, and holds a path cache over
+ * the overlay while its phandles are fixed up, as the transaction
+ * memory does for fdt_overlay_apply_txn().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, there's not enough space in the base device
+ *		tree, or in @cs
+ *	-FDT_ERR_NOTFOUND, the overlay points to some nonexistent nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_apply_changeset(void *fdt, void *fdto,
+				struct fdt_changeset *cs);
+
+/**
+ * fdt_overlay_revert - Undoes the edits recorded in a changeset
+ * @fdt: pointer to the device tree blob the changeset was recorded on
+ * @cs: changeset filled by fdt_overlay_apply_changeset()
+ * @buf: scratch memory for the transaction (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_overlay_revert() restores the old value of each property the
+ * recorded overlays overwrote and removes each property and node they
+ * added, newest first, in one transaction committed in place within
+ * the totalsize of @fdt, see fdt_txn_commit(). @fdt is left exactly as
+ * it was if any edit can't be undone. Names added to the strings block
+ * stay there.
+ *
+ * The structure block then matches the one from before the overlays
+ * were applied, provided the edits made to @fdt since were all
+ * recorded in @cs. Reverting a changeset when later overlays have
+ * touched the same nodes undoes their edits to those properties and
+ * below those nodes as well.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, @buf is too small
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_NOTFOUND, a recorded node or property no longer exists
+ *	-FDT_ERR_BADVALUE, @cs holds an unknown record
+ *	-FDT_ERR_TRUNCATED, @cs holds a truncated record
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE, standard meanings
+ */
+int fdt_overlay_revert(void *fdt, const struct fdt_changeset *cs, void *buf,
+		       int bufsize);
+
+/**
+ * fdt_overlay_compile - Compiles a DT overlay against a given base
+ * @txn: transaction just started on the base device tree
+ * @fdto: pointer to the device tree overlay blob
+ * @buf: memory for the compiled overlay (4-byte aligned)
+ * @bufsize: size of the memory at @buf
+ *
+ * fdt_overlay_compile() records the application of the overlay in
+ * @txn, see fdt_overlay_apply_txn(), and saves it to @buf as a script
+ * which fdt_overlay_apply_compiled() can replay on another copy of the
+ * same base. The phandle adjustment, the resolution of the fixups and
+ * the update of the symbols are done once, here, rather than each time
+ * the overlay is applied. The compiled overlay carries fingerprints of
+ * the contents of the base and of the overlay; it does not depend on
+ * the totalsize of the base.
+ *
+ * The overlay is modified as by fdt_overlay_apply(), and its magic is
+ * invalidated if it is valid to start with. @buf must not overlap the
+ * memory of @txn.
+ *
+ * returns:
+ *	the size in bytes of the compiled overlay, on success
+ *	-FDT_ERR_NOSPACE, there's not enough space in @buf, or in the
+ *		transaction memory
+ *	-FDT_ERR_ALIGNMENT, @buf is not 4-byte aligned
+ *	-FDT_ERR_NOTFOUND, the overlay points to some nonexistent nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_compile(struct fdt_txn *txn, void *fdto, void *buf,
+			int bufsize);
+
+/**
+ * fdt_overlay_apply_compiled - Applies a compiled DT overlay
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ * @buf: compiled overlay, from fdt_overlay_compile() (4-byte aligned)
+ * @len: size of the compiled overlay
+ *
+ * fdt_overlay_apply_compiled() merges the overlay into the base device
+ * tree, with the same result as fdt_overlay_apply(). When @fdt, @fdto
+ * and the compiled script have the fingerprints recorded in @buf, and
+ * the header the script writes is consistent with the base, the script
+ * is played back within the totalsize of the base: parts of the base are
+ * moved and the new bytes copied in, without looking up any node,
+ * property or phandle, and @fdto is left alone. Otherwise, including
+ * when @buf is not a valid compiled overlay, this falls back to
+ * fdt_overlay_apply(), which the return value tells apart so that the
+ * overlay can be compiled again.
+ *
+ * returns:
+ *	0, on success from the compiled overlay
+ *	1, on success from fdt_overlay_apply()
+ *	-FDT_ERR_NOSPACE, there's not enough space in the base device tree;
+ *		the base is left alone if the compiled overlay was used
+ *	any error of fdt_overlay_apply(), when falling back to it
+ */
+int fdt_overlay_apply_compiled(void *fdt, void *fdto, const void *buf,
+			       int len);
+
 /**********************************************************************/
 /* Debugging / informational functions                                */
 /**********************************************************************/
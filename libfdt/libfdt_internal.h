@@ -22,6 +22,110 @@ int fdt_check_node_offset_(const void *fdt, int offset);
 int fdt_check_prop_offset_(const void *fdt, int offset);
 const char *fdt_find_string_(const char *strtab, int tabsize, const char *s);
 int fdt_node_end_offset_(void *fdt, int nodeoffset);
+int fdt_blocks_misordered_(const void *fdt, int mem_rsv_size, int struct_size);
+int fdt_nodename_eq_(const void *fdt, int offset, const char *s, int len);
+int fdt_merge_node_(void *fdt, int nodeoffset, const void *fdto, int node,
+		    int *offsets, int count);
+int fdt_merge_nodes_(void *fdt, int *targets, const void *fdto,
+		     const int *nodes, int count, void *buf, int bufsize,
+		     int threads);
+
+struct fdt_index_phandle {
+	uint32_t phandle;
+	int offset;
+};
+
+struct fdt_index_node {
+	int offset;
+	int parent;	/* index of the parent entry, -1 for the root */
+	int depth;
+	int end;	/* offset just past the node's FDT_END_NODE tag */
+	int props;	/* first entry of the property table, -1 if unread */
+	int nprops;
+	int path;	/* cached path in the string area, -1 if none */
+	int pathlen;
+};
+
+struct fdt_index_path {
+	uint32_t hash;
+	int offset;	/* -1 once the path needs resolving again */
+	int str;	/* path string, in the string area */
+	int len;
+};
+
+struct fdt_index_string {
+	uint32_t hash;
+	int offset;	/* first occurrence in the strings block */
+};
+
+struct fdt_index_symbol {
+	uint32_t hash;
+	int offset;	/* of the property, from the start of the node */
+};
+
+struct fdt_index_prop {
+	int nameoff;	/* first occurrence of the name in the strings */
+	int offset;	/* of the property, from the start of the node */
+};
+
+struct fdt_index_value {
+	uint32_t hash;
+	int val;	/* one occurrence, from the structure block */
+	int len;
+	int first;	/* entries of the nodes holding it, in tree order */
+	int last;
+	int cursor;	/* entry last returned by a lookup, -1 for none */
+};
+
+struct fdt_index_value_node {
+	int offset;
+	int next;
+};
+
+struct fdt_index *fdt_index_get_(const void *fdt);
+int fdt_index_is_phandle_name_(const char *name, int namelen);
+int fdt_index_phandle_offset_(struct fdt_index *idx, uint32_t phandle);
+void fdt_index_phandle_add_(struct fdt_index *idx, uint32_t phandle,
+			    int offset);
+int fdt_index_max_phandle_(struct fdt_index *idx, uint32_t *phandle);
+void fdt_index_max_phandle_set_(struct fdt_index *idx, uint32_t phandle);
+int fdt_index_node_find_(const struct fdt_index *idx, int nodeoffset);
+int fdt_index_node_next_(const struct fdt_index *idx, int i);
+int fdt_index_path_offset_(struct fdt_index *idx, const char *path, int len);
+void fdt_index_path_add_(struct fdt_index *idx, const char *path, int len,
+			 int offset);
+int fdt_index_string_find_(struct fdt_index *idx, const char *s, int len,
+			   int *offset);
+int fdt_index_symbol_find_(struct fdt_index *idx, int nodeoffset,
+			   const char *name, int namelen);
+int fdt_index_prop_find_(struct fdt_index *idx, int nodeoffset,
+			 const char *name, int namelen);
+int fdt_index_get_path_(struct fdt_index *idx, int nodeoffset, char *buf,
+			int buflen);
+int fdt_index_compatible_next_(struct fdt_index *idx, int startoffset,
+			       const char *compatible);
+int fdt_index_prop_value_next_(struct fdt_index *idx, int startoffset,
+			       const char *propname, const void *propval,
+			       int proplen);
+void fdt_index_splice_(void *fdt, int offset, int oldlen, int newlen);
+void fdt_index_node_added_(void *fdt, int parentoffset, int nodeoffset,
+			   int len);
+void fdt_index_node_renamed_(void *fdt, int nodeoffset);
+void fdt_index_string_added_(void *fdt, int stroffset, int len);
+void fdt_index_strings_trimmed_(void *fdt);
+void fdt_index_sw_finished_(void *fdt);
+void fdt_index_moved_(void *fdt, void *buf);
+void fdt_index_rebuild_(void *fdt);
+void fdt_index_prop_changed_(void *fdt, int nodeoffset, const char *name,
+			     int namelen, const void *val, int len);
+
+int fdt_txn_find_max_phandle_(const struct fdt_txn *txn,
+			      const uint32_t *base_max, uint32_t *phandle);
+void *fdt_txn_reserve_(struct fdt_txn *txn, int len);
+uint64_t fdt_fingerprint_(const void *fdt);
+uint64_t fdt_fingerprint_buf_(const void *buf, int len);
+int fdt_txn_script_(struct fdt_txn *txn, void *script, int len);
+int fdt_txn_script_play_(void *fdt, const void *script, int len);
 
 static inline const void *fdt_offset_ptr_(const void *fdt, int offset)
 {
@@ -33,6 +137,12 @@ static inline void *fdt_offset_ptr_w_(void *fdt, int offset)
 	return (void *)(uintptr_t)fdt_offset_ptr_(fdt, offset);
 }
 
+/* Size of the blob up to the end of the strings block */
+static inline unsigned int fdt_data_size_(const void *fdt)
+{
+	return fdt_off_dt_strings(fdt) + fdt_size_dt_strings(fdt);
+}
+
 static inline const struct fdt_reserve_entry *fdt_mem_rsv_(const void *fdt, int n)
 {
 	const struct fdt_reserve_entry *rsv_table =